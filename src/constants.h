@@ -15,9 +15,15 @@ constexpr unsigned long SEND_TIMEOUT = 300;
 constexpr uint8_t SEND_ERROR_BEFORE_RESET = 3;
 constexpr uint8_t SEND_RETRY_COUNT = 2;
 constexpr uint8_t SEND_RETRY_DELAY = 100;
+constexpr uint8_t SEND_RETRY_BACKOFF_FACTOR = 2;
+// Spreads retries of buttons which failed at the same time
+constexpr unsigned long SEND_RETRY_JITTER = 20;
 
 constexpr unsigned long DELAY_AMOUNT = 10;
 
+// Allowed timer lateness, lets timers expiring close to each other share one wakeup
+constexpr unsigned long TIMER_SLACK = 10;
+
 constexpr unsigned long BUTTON_WAIT_TIMEOUT = 600;
 constexpr unsigned long BUTTON_REPEAT_TIMEOUT = 1000;
 
@@ -0,0 +1,152 @@
+#include "async_semaphore.h"
+
+#include "../debug.h"
+
+AsyncSemaphore::Permit &AsyncSemaphore::Permit::operator=(Permit &&other) noexcept {
+    if (this == &other) return *this;
+
+    release();
+    _semaphore = other._semaphore;
+    other._semaphore = nullptr;
+
+    return *this;
+}
+
+void AsyncSemaphore::Permit::release() {
+    if (_semaphore == nullptr) return;
+
+    auto *semaphore = _semaphore;
+    _semaphore = nullptr;
+
+    semaphore->_release();
+}
+
+AsyncSemaphore::AsyncSemaphore(uint16_t permits, Dispatcher::Priority priority, uint8_t worker) :
+    _available(permits), _priority(priority), _worker(worker) {}
+
+AsyncSemaphore::~AsyncSemaphore() {
+    portENTER_CRITICAL(&_spinlock);
+    auto *waiter = _head;
+    _head = _tail = nullptr;
+    _waiting = 0;
+    portEXIT_CRITICAL(&_spinlock);
+
+    while (waiter != nullptr) {
+        auto *next = waiter->next;
+        waiter->promise->set_error();
+        delete waiter;
+
+        waiter = next;
+    }
+}
+
+Future<AsyncSemaphore::Permit> AsyncSemaphore::acquire() {
+    // Allocated outside of critical section, freed right away if permit is free
+    auto promise = Promise<Permit>::create();
+    promise->set_priority(_priority);
+    promise->set_worker(_worker);
+
+    auto *waiter = new Waiter {promise};
+
+    portENTER_CRITICAL(&_spinlock);
+
+    ++_stats.acquired;
+
+    const bool granted = _available > 0 && _head == nullptr;
+    if (granted) {
+        --_available;
+    } else {
+        if (_tail != nullptr) _tail->next = waiter;
+        else _head = waiter;
+        _tail = waiter;
+
+        ++_waiting;
+        ++_stats.waited;
+        _stats.max_waiting = std::max<uint32_t>(_stats.max_waiting, _waiting);
+    }
+
+    portEXIT_CRITICAL(&_spinlock);
+
+    if (granted) {
+        delete waiter;
+        promise->set_success(Permit {this});
+    } else {
+        VERBOSE(D_PRINTF("AsyncSemaphore (%p): No permits available. Waiting\r\n", this));
+    }
+
+    return Future {promise};
+}
+
+AsyncSemaphore::Permit AsyncSemaphore::try_acquire() {
+    portENTER_CRITICAL(&_spinlock);
+
+    const bool granted = _available > 0 && _head == nullptr;
+    if (granted) {
+        --_available;
+        ++_stats.acquired;
+    }
+
+    portEXIT_CRITICAL(&_spinlock);
+
+    return granted ? Permit {this} : Permit {};
+}
+
+void AsyncSemaphore::_release() {
+    while (true) {
+        portENTER_CRITICAL(&_spinlock);
+
+        auto *waiter = _head;
+        if (waiter == nullptr) {
+            ++_available;
+            portEXIT_CRITICAL(&_spinlock);
+
+            return;
+        }
+
+        _head = waiter->next;
+        if (_head == nullptr) _tail = nullptr;
+        --_waiting;
+
+        portEXIT_CRITICAL(&_spinlock);
+
+        auto promise = std::move(waiter->promise);
+        delete waiter;
+
+        // Permit goes straight to the waiter. If it is cancelled meanwhile, permit dies with the value and comes back here
+        if (!promise->finished()) {
+            promise->set_success(Permit {this});
+            return;
+        }
+    }
+}
+
+uint16_t AsyncSemaphore::available() const {
+    portENTER_CRITICAL(&_spinlock);
+    const auto result = _available;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+uint16_t AsyncSemaphore::waiting() const {
+    portENTER_CRITICAL(&_spinlock);
+    const auto result = _waiting;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+AsyncSemaphoreStats AsyncSemaphore::stats() const {
+    portENTER_CRITICAL(&_spinlock);
+    const auto result = _stats;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+void AsyncSemaphore::reset_stats() {
+    portENTER_CRITICAL(&_spinlock);
+    _stats = {};
+    _stats.max_waiting = _waiting;
+    portEXIT_CRITICAL(&_spinlock);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+
+#include "promise.h"
+
+struct AsyncSemaphoreStats {
+    uint32_t acquired = 0;
+    // Acquisitions which had to wait for a permit
+    uint32_t waited = 0;
+    uint32_t max_waiting = 0;
+};
+
+/**
+ * Counting semaphore for asynchronous code: ::acquire() returns future resolved once permit is free.
+ * Permits are granted in request order, so a steady stream of ::try_acquire() can't starve waiters.
+ * Semaphore must outlive its permits, so it is usually a member of a long-living service.
+ */
+class AsyncSemaphore {
+public:
+    // Move-only ownership of a single permit, released on destruction
+    class Permit {
+        AsyncSemaphore *_semaphore = nullptr;
+
+        friend class AsyncSemaphore;
+
+        explicit Permit(AsyncSemaphore *semaphore) : _semaphore(semaphore) {}
+
+    public:
+        Permit() = default;
+        ~Permit() { release(); }
+
+        Permit(Permit &&other) noexcept : _semaphore(other._semaphore) { other._semaphore = nullptr; }
+        Permit &operator=(Permit &&other) noexcept;
+
+        Permit(const Permit &) = delete;
+        Permit &operator=(Permit const &) = delete;
+
+        void release();
+
+        explicit operator bool() const { return _semaphore != nullptr; }
+    };
+
+private:
+    struct Waiter {
+        std::shared_ptr<Promise<Permit>> promise;
+        Waiter *next = nullptr;
+    };
+
+    mutable portMUX_TYPE _spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+    uint16_t _available;
+    uint16_t _waiting = 0;
+
+    Waiter *_head = nullptr;
+    Waiter *_tail = nullptr;
+
+    Dispatcher::Priority _priority;
+    uint8_t _worker;
+
+    AsyncSemaphoreStats _stats;
+
+public:
+    // Priority and worker are applied to acquisition futures, e.g. to keep continuations of one peer in order
+    explicit AsyncSemaphore(uint16_t permits, Dispatcher::Priority priority = Dispatcher::Priority::NORMAL,
+        uint8_t worker = Dispatcher::NO_WORKER);
+    ~AsyncSemaphore();
+
+    AsyncSemaphore(const AsyncSemaphore &) = delete;
+    AsyncSemaphore &operator=(AsyncSemaphore const &) = delete;
+
+    // Cancelled acquisition gives up its place, permit goes to the next waiter
+    Future<Permit> acquire();
+
+    // Empty permit if none is free or somebody is already waiting
+    Permit try_acquire();
+
+    [[nodiscard]] uint16_t available() const;
+    // Includes cancelled acquisitions until their turn comes
+    [[nodiscard]] uint16_t waiting() const;
+
+    [[nodiscard]] AsyncSemaphoreStats stats() const;
+    void reset_stats();
+
+private:
+    void _release();
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+#include <optional>
+
+#include "promise.h"
+#include "../debug.h"
+
+// How long BLOCK stream producer waits for space before dropping the value
+#ifndef ASYNC_STREAM_BLOCK_TIMEOUT
+#define ASYNC_STREAM_BLOCK_TIMEOUT                          (100ul)
+#endif
+
+enum class StreamOverflow : uint8_t {
+    // Oldest buffered value gives place to the new one
+    DROP_OLDEST,
+    // New value is dropped
+    DROP_NEWEST,
+    // Producer waits for space up to block timeout, then drops new value. Never blocks in ISR
+    BLOCK,
+};
+
+struct AsyncStreamStats {
+    uint32_t pushed = 0;
+    uint32_t delivered = 0;
+    // Values lost to overflow, either oldest or newest ones depending on policy
+    uint32_t dropped = 0;
+    // Pushes which had to wait for space
+    uint32_t blocked = 0;
+    uint32_t high_water = 0;
+};
+
+/**
+ * Bounded buffer of values between producer, e.g. radio callback, and asynchronous consumer.
+ *
+ * Producer never waits for the consumer to process a value, only for free space in BLOCK mode.
+ * Stream has a single consumer: ::next() called while previous future is pending returns the same future.
+ * Closed stream still delivers buffered values, after that ::next() fails.
+ */
+template<typename T, size_t Capacity>
+class AsyncStream {
+    static_assert(Capacity > 0, "AsyncStream: Capacity must be positive");
+
+    mutable portMUX_TYPE _spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+    StreamOverflow _overflow;
+    unsigned long _block_timeout;
+    SemaphoreHandle_t _space = nullptr;
+
+    std::optional<T> _buffer[Capacity];
+    size_t _head = 0;
+    size_t _size = 0;
+
+    std::shared_ptr<Promise<T>> _waiting;
+    bool _closed = false;
+
+    AsyncStreamStats _stats;
+
+public:
+    explicit AsyncStream(StreamOverflow overflow = StreamOverflow::DROP_OLDEST, unsigned long block_timeout = ASYNC_STREAM_BLOCK_TIMEOUT);
+    ~AsyncStream();
+
+    AsyncStream(const AsyncStream &) = delete;
+    AsyncStream &operator=(AsyncStream const &) = delete;
+
+    // Returns false if value was dropped
+    bool push(T value);
+
+    Future<T> next();
+
+    // Fails pending ::next(), new values are dropped until ::open()
+    void close();
+    void open();
+
+    [[nodiscard]] bool closed() const;
+    [[nodiscard]] size_t size() const;
+    static constexpr size_t capacity() { return Capacity; }
+
+    [[nodiscard]] StreamOverflow overflow() const { return _overflow; }
+
+    [[nodiscard]] AsyncStreamStats stats() const;
+    void reset_stats();
+};
+
+template<typename T, size_t Capacity>
+AsyncStream<T, Capacity>::AsyncStream(StreamOverflow overflow, unsigned long block_timeout) :
+    _overflow(overflow), _block_timeout(block_timeout) {
+    if (_overflow != StreamOverflow::BLOCK) return;
+
+    _space = xSemaphoreCreateBinary();
+    if (_space == nullptr) {
+        D_PRINT("AsyncStream: Unable to create semaphore. Dropping newest values instead");
+        _overflow = StreamOverflow::DROP_NEWEST;
+    }
+}
+
+template<typename T, size_t Capacity>
+AsyncStream<T, Capacity>::~AsyncStream() {
+    close();
+    if (_space != nullptr) vSemaphoreDelete(_space);
+}
+
+template<typename T, size_t Capacity>
+bool AsyncStream<T, Capacity>::push(T value) {
+    const bool can_block = _overflow == StreamOverflow::BLOCK && !xPortInIsrContext();
+    const auto started_at = millis();
+    bool waited = false;
+
+    // Destroyed outside of critical section
+    std::optional<T> dropped;
+    std::shared_ptr<Promise<T>> waiting;
+
+    while (true) {
+        portENTER_CRITICAL(&_spinlock);
+
+        if (_closed) {
+            portEXIT_CRITICAL(&_spinlock);
+            return false;
+        }
+
+        // Cancelled waiter is left for the next ::next(), value goes to the buffer
+        if (_waiting && !_waiting->finished()) {
+            waiting = std::move(_waiting);
+            _waiting.reset();
+            portEXIT_CRITICAL(&_spinlock);
+
+            if (waiting->try_set_success(value)) {
+                portENTER_CRITICAL(&_spinlock);
+                ++_stats.pushed;
+                ++_stats.delivered;
+                portEXIT_CRITICAL(&_spinlock);
+
+                return true;
+            }
+
+            // Cancelled or expired meanwhile, value is still ours and goes the regular way
+            waiting.reset();
+            continue;
+        }
+
+        if (_size < Capacity) {
+            _buffer[(_head + _size) % Capacity].emplace(std::move(value));
+            ++_size;
+
+            ++_stats.pushed;
+            _stats.high_water = std::max<uint32_t>(_stats.high_water, _size);
+            portEXIT_CRITICAL(&_spinlock);
+
+            return true;
+        }
+
+        if (_overflow == StreamOverflow::DROP_OLDEST) {
+            // Oldest slot becomes the newest one
+            dropped.swap(_buffer[_head]);
+            _buffer[_head].emplace(std::move(value));
+            _head = (_head + 1) % Capacity;
+
+            ++_stats.pushed;
+            ++_stats.dropped;
+            portEXIT_CRITICAL(&_spinlock);
+
+            return true;
+        }
+
+        const auto elapsed = millis() - started_at;
+        if (!can_block || elapsed >= _block_timeout) {
+            ++_stats.dropped;
+            portEXIT_CRITICAL(&_spinlock);
+
+            VERBOSE(D_PRINT("AsyncStream: Stream is full. Dropping value"));
+            return false;
+        }
+
+        if (!waited) ++_stats.blocked;
+        waited = true;
+
+        portEXIT_CRITICAL(&_spinlock);
+
+        xSemaphoreTake(_space, pdMS_TO_TICKS(_block_timeout - elapsed) + 1);
+    }
+}
+
+template<typename T, size_t Capacity>
+Future<T> AsyncStream<T, Capacity>::next() {
+    // Allocated outside of critical section, resolved right away if value is ready
+    auto promise = Promise<T>::create();
+    std::optional<T> value;
+    // Promise left unused is released after critical section
+    std::shared_ptr<Promise<T>> spare;
+
+    portENTER_CRITICAL(&_spinlock);
+
+    if (_size > 0) {
+        value.swap(_buffer[_head]);
+        _head = (_head + 1) % Capacity;
+        --_size;
+
+        ++_stats.delivered;
+    } else if (_closed) {
+        portEXIT_CRITICAL(&_spinlock);
+        return Future<T>::errored();
+    } else if (_waiting && !_waiting->finished()) {
+        spare = std::move(promise);
+        promise = _waiting;
+    } else {
+        spare = std::move(_waiting);
+        _waiting = promise;
+    }
+
+    portEXIT_CRITICAL(&_spinlock);
+
+    if (value.has_value()) {
+        if (_space != nullptr) xSemaphoreGive(_space);
+        promise->set_success(std::move(*value));
+    }
+
+    return Future {promise};
+}
+
+template<typename T, size_t Capacity>
+void AsyncStream<T, Capacity>::close() {
+    portENTER_CRITICAL(&_spinlock);
+    _closed = true;
+    auto waiting = std::move(_waiting);
+    _waiting.reset();
+    portEXIT_CRITICAL(&_spinlock);
+
+    // Blocked producer wakes up and finds stream closed
+    if (_space != nullptr) xSemaphoreGive(_space);
+    if (waiting) waiting->set_error();
+}
+
+template<typename T, size_t Capacity>
+void AsyncStream<T, Capacity>::open() {
+    portENTER_CRITICAL(&_spinlock);
+    _closed = false;
+    portEXIT_CRITICAL(&_spinlock);
+}
+
+template<typename T, size_t Capacity>
+bool AsyncStream<T, Capacity>::closed() const {
+    portENTER_CRITICAL(&_spinlock);
+    const bool result = _closed;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+template<typename T, size_t Capacity>
+size_t AsyncStream<T, Capacity>::size() const {
+    portENTER_CRITICAL(&_spinlock);
+    const auto result = _size;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+template<typename T, size_t Capacity>
+AsyncStreamStats AsyncStream<T, Capacity>::stats() const {
+    portENTER_CRITICAL(&_spinlock);
+    const auto result = _stats;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return result;
+}
+
+template<typename T, size_t Capacity>
+void AsyncStream<T, Capacity>::reset_stats() {
+    portENTER_CRITICAL(&_spinlock);
+    _stats = {};
+    _stats.high_water = _size;
+    portEXIT_CRITICAL(&_spinlock);
+}
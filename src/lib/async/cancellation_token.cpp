@@ -0,0 +1,110 @@
+#include "cancellation_token.h"
+
+#include "../debug.h"
+
+CancellationToken::State::~State() {
+    while (head != nullptr) {
+        auto *next = head->next;
+        delete head;
+        head = next;
+    }
+}
+
+CancellationToken CancellationToken::create() {
+    CancellationToken result;
+    result._state = std::make_shared<State>();
+
+    return result;
+}
+
+bool CancellationToken::cancel() const {
+    if (!_state) return false;
+
+    portENTER_CRITICAL(&_state->spinlock);
+
+    if (_state->cancelled) {
+        portEXIT_CRITICAL(&_state->spinlock);
+        return false;
+    }
+
+    _state->cancelled = true;
+    auto *subscription = _state->head;
+    _state->head = _state->tail = nullptr;
+
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    VERBOSE(D_PRINTF("CancellationToken (%p): Cancelled\r\n", _state.get()));
+
+    while (subscription != nullptr) {
+        auto *next = subscription->next;
+        subscription->handler();
+        delete subscription;
+
+        subscription = next;
+    }
+
+    return true;
+}
+
+bool CancellationToken::cancelled() const {
+    if (!_state) return false;
+
+    portENTER_CRITICAL(&_state->spinlock);
+    const bool result = _state->cancelled;
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    return result;
+}
+
+uint32_t CancellationToken::subscribe(CancellationHandler handler) const {
+    if (!_state) return INVALID_SUBSCRIPTION;
+
+    auto *subscription = new Subscription {.handler = std::move(handler)};
+
+    portENTER_CRITICAL(&_state->spinlock);
+
+    if (_state->cancelled) {
+        portEXIT_CRITICAL(&_state->spinlock);
+
+        subscription->handler();
+        delete subscription;
+
+        return INVALID_SUBSCRIPTION;
+    }
+
+    if (++_state->next_id == INVALID_SUBSCRIPTION) ++_state->next_id;
+
+    const auto id = subscription->id = _state->next_id;
+    if (_state->tail != nullptr) _state->tail->next = subscription;
+    else _state->head = subscription;
+    _state->tail = subscription;
+
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    return id;
+}
+
+void CancellationToken::unsubscribe(uint32_t id) const {
+    if (!_state || id == INVALID_SUBSCRIPTION) return;
+
+    Subscription *prev = nullptr;
+
+    portENTER_CRITICAL(&_state->spinlock);
+
+    auto *subscription = _state->head;
+    while (subscription != nullptr && subscription->id != id) {
+        prev = subscription;
+        subscription = subscription->next;
+    }
+
+    if (subscription != nullptr) {
+        if (prev != nullptr) prev->next = subscription->next;
+        else _state->head = subscription->next;
+        if (_state->tail == subscription) _state->tail = prev;
+    }
+
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    // Handler is destroyed outside of critical section: it may own the last reference to a promise
+    delete subscription;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+
+#include "../misc/inplace_function.h"
+
+#ifndef CANCELLATION_HANDLER_CAPACITY
+#define CANCELLATION_HANDLER_CAPACITY                       (4 * sizeof(void *))
+#endif
+
+typedef InplaceFunction<void(), CANCELLATION_HANDLER_CAPACITY> CancellationHandler;
+
+/**
+ * Shared cancellation flag with subscribers. Copies refer to the same token.
+ * Default constructed token is empty: it is never cancelled and ignores subscriptions.
+ */
+class CancellationToken {
+    // Allocated before taking the lock, so subscribing never allocates in critical section
+    struct Subscription {
+        uint32_t id = 0;
+        CancellationHandler handler;
+        Subscription *next = nullptr;
+    };
+
+    struct State {
+        portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+        bool cancelled = false;
+        uint32_t next_id = 0;
+
+        // In subscription order
+        Subscription *head = nullptr;
+        Subscription *tail = nullptr;
+
+        State() = default;
+        ~State();
+
+        State(const State &) = delete;
+        State &operator=(State const &) = delete;
+    };
+
+    std::shared_ptr<State> _state;
+
+public:
+    static constexpr uint32_t INVALID_SUBSCRIPTION = 0;
+
+    CancellationToken() = default;
+
+    static CancellationToken create();
+
+    // Runs subscribed handlers once. Returns false if token is empty or already cancelled
+    bool cancel() const; // NOLINT(*-use-nodiscard)
+
+    [[nodiscard]] bool cancelled() const;
+
+    // Handler runs on cancellation, or right away if token is already cancelled
+    uint32_t subscribe(CancellationHandler handler) const;
+    void unsubscribe(uint32_t id) const;
+
+    explicit operator bool() const { return _state != nullptr; }
+};
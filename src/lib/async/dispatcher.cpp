@@ -5,13 +5,20 @@
 
 #define xIsInISR() (xPortInIsrContext() || xPortInterruptedFromISRContext())
 
-bool Dispatcher::initialized = false;
-uint64_t Dispatcher::begin_processing_micros = 0;
-int Dispatcher::processed_tasks = 0;
-TaskHandle_t Dispatcher::task_handle = nullptr;
+static_assert(DISPATCHER_WORKER_COUNT > 0 && DISPATCHER_WORKER_COUNT < Dispatcher::NO_WORKER,
+    "DISPATCHER_WORKER_COUNT is out of range");
 
+bool Dispatcher::initialized = false;
 portMUX_TYPE Dispatcher::spinlock = portMUX_INITIALIZER_UNLOCKED;
-std::queue<Dispatcher::DispatchFn> Dispatcher::dispatched {};
+Dispatcher::Worker Dispatcher::workers[DISPATCHER_WORKER_COUNT] {};
+Dispatcher::IsrQueue Dispatcher::isr_events {};
+
+std::atomic<uint32_t> Dispatcher::dispatched_count {0};
+std::atomic<uint32_t> Dispatcher::overflowed_count {0};
+std::atomic<uint32_t> Dispatcher::dropped_count {0};
+std::atomic<uint32_t> Dispatcher::next_worker {0};
+std::atomic<uint32_t> Dispatcher::isr_dispatched_count {0};
+std::atomic<uint32_t> Dispatcher::isr_dropped_count {0};
 
 bool Dispatcher::begin() {
     if (xIsInISR()) {
@@ -22,17 +29,29 @@ bool Dispatcher::begin() {
     portENTER_CRITICAL(&spinlock);
 
     if (!initialized) {
-        auto ret = xTaskCreatePinnedToCore(dispatcher_task, "DispatcherTask",
-            DISPATCHER_STACK_SIZE, nullptr, DISPATCHER_TASK_PRIORITY, &task_handle, xPortGetCoreID());
+        const auto core_id = xPortGetCoreID();
+
+        for (uint8_t i = 0; i < DISPATCHER_WORKER_COUNT; ++i) {
+            auto &worker = workers[i];
+            if (worker.task_handle != nullptr) continue;
+
+            worker.index = i;
+
+            char name[configMAX_TASK_NAME_LEN] = "DispatcherTask";
+            if (DISPATCHER_WORKER_COUNT > 1) snprintf(name, sizeof(name), "DispatcherTask%u", i);
 
-        if (ret != pdPASS) {
-            D_PRINTF("Dispatcher: Failed to start task: %x\r\n", pdPASS);
+            auto ret = xTaskCreatePinnedToCore(dispatcher_task, name, DISPATCHER_STACK_SIZE, &worker,
+                DISPATCHER_TASK_PRIORITY, &worker.task_handle, (core_id + i) % portNUM_PROCESSORS);
 
-            portEXIT_CRITICAL(&spinlock);
-            return false;
+            if (ret != pdPASS) {
+                D_PRINTF("Dispatcher: Failed to start worker %u: %x\r\n", i, ret);
+
+                portEXIT_CRITICAL(&spinlock);
+                return false;
+            }
         }
 
-        VERBOSE(D_PRINT("Dispatcher: Initialized"));
+        VERBOSE(D_PRINTF("Dispatcher: Initialized with %u workers\r\n", DISPATCHER_WORKER_COUNT));
         initialized = true;
     }
 
@@ -40,74 +59,446 @@ bool Dispatcher::begin() {
     return true;
 }
 
-bool Dispatcher::dispatch(DispatchFn fn) {
+bool Dispatcher::dispatch(DispatchFn fn, Priority priority) {
     if (!initialized && !begin()) return false;
 
-    portENTER_CRITICAL(&spinlock);
-    dispatched.push(std::move(fn));
+    // Keep continuations on the current worker while it's possible, idle workers will steal them otherwise
+    auto *current = worker_of_current_task();
+    return submit(current != nullptr ? *current : select_worker(), false, fn, priority);
+}
+
+bool Dispatcher::dispatch_to(uint8_t worker, DispatchFn fn, Priority priority) {
+    if (worker >= DISPATCHER_WORKER_COUNT) {
+        D_PRINTF("Dispatcher: Invalid worker index: %u\r\n", worker);
+        return false;
+    }
+
+    if (!initialized && !begin()) return false;
+
+    return submit(workers[worker], true, fn, priority);
+}
+
+bool Dispatcher::dispatch_inline(DispatchFn fn, Priority priority, uint8_t worker) {
+    auto *current = worker_of_current_task();
+    if (current == nullptr || !can_run_inline(*current, priority, worker)) {
+        return worker != NO_WORKER ? dispatch_to(worker, std::move(fn), priority) : dispatch(std::move(fn), priority);
+    }
+
+    const auto prev_priority = current->running_priority;
+    current->running_priority = std::max(prev_priority, priority);
+    ++current->inline_depth;
+    ++current->statistics.inlined;
+
+    fn();
+
+    --current->inline_depth;
+    current->running_priority = prev_priority;
+
+    return true;
+}
+
+uint8_t Dispatcher::worker_for(uint64_t key) {
+    // Keys like MAC addresses share low bits, so mix them before picking a worker
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+
+    return key % DISPATCHER_WORKER_COUNT;
+}
+
+uint8_t Dispatcher::current_worker() {
+    auto *worker = worker_of_current_task();
+    return worker != nullptr ? worker->index : NO_WORKER;
+}
+
+Dispatcher::Priority Dispatcher::current_priority() {
+    auto *worker = worker_of_current_task();
+    return worker != nullptr ? worker->running_priority : Priority::NORMAL;
+}
+
+DispatcherStats Dispatcher::stats() {
+    DispatcherStats result {};
+
+    for (auto &worker: workers) {
+        const auto &stats = worker.statistics;
+
+        result.processed += stats.processed;
+        result.stolen += stats.stolen;
+        result.inlined += stats.inlined;
+        result.wakeups += stats.wakeups;
+        result.yields += stats.yields;
+        result.last_tasks_per_wake += stats.last_tasks_per_wake;
+        result.max_tasks_per_wake = std::max(result.max_tasks_per_wake, stats.max_tasks_per_wake);
+
+        for (uint8_t i = 0; i < 2; ++i) {
+            result.queue_high_water[i] = std::max(result.queue_high_water[i], stats.queue_high_water[i]);
+        }
+
+        result.pinned_queue_high_water = std::max(result.pinned_queue_high_water, stats.pinned_queue_high_water);
+        result.isr_queue_high_water = std::max(result.isr_queue_high_water, stats.isr_queue_high_water);
+
+        result.total_execution_micros += stats.total_execution_micros;
+        result.max_execution_micros = std::max(result.max_execution_micros, stats.max_execution_micros);
+
+        for (uint8_t i = 0; i < result.latency_micros.size(); ++i) {
+            result.latency_micros.buckets[i] += stats.latency_micros.buckets[i];
+            result.execution_micros.buckets[i] += stats.execution_micros.buckets[i];
+        }
+    }
+
+    result.dispatched = dispatched_count.load(std::memory_order_relaxed);
+    result.overflowed = overflowed_count.load(std::memory_order_relaxed);
+    result.dropped = dropped_count.load(std::memory_order_relaxed);
+    result.isr_dispatched = isr_dispatched_count.load(std::memory_order_relaxed);
+    result.isr_dropped = isr_dropped_count.load(std::memory_order_relaxed);
+
+    return result;
+}
+
+DispatcherStats Dispatcher::stats(uint8_t worker) {
+    if (worker >= DISPATCHER_WORKER_COUNT) return {};
+    return workers[worker].statistics;
+}
+
+void Dispatcher::reset_stats() {
+    for (auto &worker: workers) worker.statistics = {};
+
+    dispatched_count.store(0, std::memory_order_relaxed);
+    overflowed_count.store(0, std::memory_order_relaxed);
+    dropped_count.store(0, std::memory_order_relaxed);
+    isr_dispatched_count.store(0, std::memory_order_relaxed);
+    isr_dropped_count.store(0, std::memory_order_relaxed);
+}
+
+Dispatcher::Worker *Dispatcher::worker_of_current_task() {
+    if (xIsInISR()) return nullptr;
+
+    const auto handle = xTaskGetCurrentTaskHandle();
+    for (auto &worker: workers) {
+        if (worker.task_handle == handle) return &worker;
+    }
+
+    return nullptr;
+}
+
+Dispatcher::Worker &Dispatcher::select_worker() {
+    if (DISPATCHER_WORKER_COUNT == 1) return workers[0];
+
+    // Least loaded worker, rotating start point to spread ties
+    const auto start = next_worker.fetch_add(1, std::memory_order_relaxed);
+
+    Worker *result = nullptr;
+    uint32_t min_size = UINT32_MAX;
+
+    for (uint8_t i = 0; i < DISPATCHER_WORKER_COUNT; ++i) {
+        auto &worker = workers[(start + i) % DISPATCHER_WORKER_COUNT];
+
+        const auto size = worker.lanes[0].size() + worker.lanes[1].size()
+                          + worker.lane_overflows[0].size.load(std::memory_order_relaxed)
+                          + worker.lane_overflows[1].size.load(std::memory_order_relaxed);
+        if (size < min_size) {
+            min_size = size;
+            result = &worker;
+        }
+    }
+
+    return *result;
+}
+
+bool Dispatcher::can_run_inline(Worker &current, Priority priority, uint8_t worker) {
+    if (current.inline_depth >= DISPATCHER_INLINE_DEPTH_LIMIT) return false;
+    if (worker != NO_WORKER && worker != current.index) return false;
+
+    return priority == Priority::URGENT || current.lane(Priority::URGENT).empty();
+}
+
+bool Dispatcher::submit(Worker &worker, bool pinned, DispatchFn &fn, Priority priority) {
+    if (!enqueue(worker, pinned, fn, priority)) {
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    dispatched_count.fetch_add(1, std::memory_order_relaxed);
+    wake_up(worker);
+
+    return true;
+}
+
+bool Dispatcher::enqueue(Worker &worker, bool pinned, DispatchFn &fn, Priority priority) {
+    Task task {.fn = std::move(fn), .enqueued_at = (uint32_t) esp_timer_get_time(), .priority = priority};
+
+    const bool in_isr = xIsInISR();
+    auto &overflow = worker.overflow(pinned, priority);
+
+    // ISR can't allocate, so it rather overtakes overflown functions than loses its own
+    if (in_isr || overflow.size.load(std::memory_order_acquire) == 0) {
+        if (pinned ? worker.pinned.push(std::move(task)) : worker.lane(priority).push(std::move(task))) return true;
+    }
+
+    if (in_isr) {
+        fn = std::move(task.fn);
+        return false;
+    }
+
+    // Producer never waits for the worker and never runs the function itself
+    push_overflow(worker, overflow, std::move(task));
+    return true;
+}
+
+void Dispatcher::push_overflow(Worker &worker, Overflow &overflow, Task &&task) {
+    auto *node = new OverflowNode {.task = std::move(task)};
+
+    portENTER_CRITICAL(&worker.overflow_spinlock);
+
+    if (overflow.tail != nullptr) overflow.tail->next = node;
+    else overflow.head = node;
+    overflow.tail = node;
+    overflow.size.fetch_add(1, std::memory_order_release);
+
+    portEXIT_CRITICAL(&worker.overflow_spinlock);
 
-    bool success = xIsInISR() ? notify_from_isr() : notify();
+    overflowed_count.fetch_add(1, std::memory_order_relaxed);
+    VERBOSE(D_PRINTF("Dispatcher: Worker %u queue is full. Function goes to overflow list\r\n", worker.index));
+}
+
+bool Dispatcher::pop_overflow(Worker &worker, Overflow &overflow, Task &out) {
+    if (overflow.size.load(std::memory_order_acquire) == 0) return false;
+
+    portENTER_CRITICAL(&worker.overflow_spinlock);
+
+    auto *node = overflow.head;
+    if (node != nullptr) {
+        overflow.head = node->next;
+        if (overflow.head == nullptr) overflow.tail = nullptr;
+        overflow.size.fetch_sub(1, std::memory_order_release);
+    }
+
+    portEXIT_CRITICAL(&worker.overflow_spinlock);
+
+    if (node == nullptr) return false;
+
+    out = std::move(node->task);
+    delete node;
+
+    return true;
+}
+
+void Dispatcher::wake_up(Worker &worker) {
+    const bool in_isr = xIsInISR();
+
+    bool success = in_isr ? notify_from_isr(worker) : notify(worker);
     if (!success) {
+        // Function is already queued, it will be processed on the next wake up
         D_PRINT("Dispatcher: Failed to notify dispatcher task");
-        dispatched.pop();
     }
 
-    portEXIT_CRITICAL(&spinlock);
-    return success;
+    if (DISPATCHER_WORKER_COUNT == 1 || worker.idle.load(std::memory_order_acquire)) return;
+
+    // Target worker is busy, let an idle one steal the function
+    for (auto &other: workers) {
+        if (&other == &worker || !other.idle.load(std::memory_order_acquire)) continue;
+
+        in_isr ? notify_from_isr(other) : notify(other);
+        break;
+    }
+}
+
+void Dispatcher::wake_up_any() {
+    Worker *target = nullptr;
+    for (auto &worker: workers) {
+        if (worker.idle.load(std::memory_order_acquire)) {
+            target = &worker;
+            break;
+        }
+    }
+
+    // No idle worker, or one is about to become idle without being marked yet. Notification stays pending
+    // until the worker waits for it again, so notifying a busy worker still guarantees one more pass
+    if (target == nullptr) target = &workers[next_worker.fetch_add(1, std::memory_order_relaxed) % DISPATCHER_WORKER_COUNT];
+
+    xIsInISR() ? notify_from_isr(*target) : notify(*target);
 }
 
-bool Dispatcher::notify_from_isr() {
-    return xTaskNotifyFromISR(task_handle, 0, eNoAction, nullptr) == pdPASS;
+bool Dispatcher::notify_from_isr(Worker &worker) {
+    return xTaskNotifyFromISR(worker.task_handle, 0, eNoAction, nullptr) == pdPASS;
 }
 
-bool Dispatcher::notify() {
-    return xTaskNotify(task_handle, 0, eNoAction) == pdPASS;
+bool Dispatcher::notify(Worker &worker) {
+    return xTaskNotify(worker.task_handle, 0, eNoAction) == pdPASS;
 }
 
-[[noreturn]] void Dispatcher::dispatcher_task(void *) {
+[[noreturn]] void Dispatcher::dispatcher_task(void *arg) {
+    auto &worker = *(Worker *) arg;
+
     while (true) {
-        VERBOSE(D_PRINT("Dispatcher: Wait for events..."));
+        VERBOSE(D_PRINTF("Dispatcher: Worker %u wait for events...\r\n", worker.index));
+
+        worker.idle.store(true, std::memory_order_release);
         xTaskNotifyWaitIndexed(0, 0x00, ULONG_MAX, nullptr, portMAX_DELAY);
-        VERBOSE(D_PRINT("Dispatcher: Received event."));
+        worker.idle.store(false, std::memory_order_release);
 
-        begin_processing_micros = esp_timer_get_time();
-        processed_tasks = 0;
+        VERBOSE(D_PRINTF("Dispatcher: Worker %u received event.\r\n", worker.index));
+
+        worker.begin_processing_micros = esp_timer_get_time();
+        worker.processed_tasks = 0;
 
         bool has_more;
         do {
-            has_more = process_pending_tasks();
-            if (has_more) delay_if_too_long();
+            has_more = process_pending_tasks(worker);
+            if (has_more) delay_if_too_long(worker);
         } while (has_more);
+
+        auto &statistics = worker.statistics;
+        ++statistics.wakeups;
+        statistics.last_tasks_per_wake = worker.processed_tasks;
+        statistics.max_tasks_per_wake = std::max<uint32_t>(statistics.max_tasks_per_wake, worker.processed_tasks);
     }
 }
 
-bool Dispatcher::process_pending_tasks() {
-    portENTER_CRITICAL(&spinlock);
+bool Dispatcher::push_isr_event(DispatcherIsrEvent::Handler handler, const void *payload, uint8_t size) {
+    if (!initialized || size > DISPATCHER_ISR_PAYLOAD_SIZE) {
+        isr_dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
 
-    bool empty = dispatched.empty();
-    if (empty) {
-        portEXIT_CRITICAL(&spinlock);
+    DispatcherIsrEvent event;
+    event.handler = handler;
+    event.timestamp = (uint32_t) esp_timer_get_time();
+    if (size > 0) memcpy(event.payload, payload, size);
+
+    if (!isr_events.push(std::move(event))) {
+        isr_dropped_count.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
-    auto callback = std::move(dispatched.front());
-    dispatched.pop();
+    isr_dispatched_count.fetch_add(1, std::memory_order_relaxed);
+    wake_up_any();
 
-    empty = dispatched.empty();
-    portEXIT_CRITICAL(&spinlock);
+    return true;
+}
+
+bool Dispatcher::run_isr_event(Worker &worker) {
+    DispatcherIsrEvent event;
 
-    VERBOSE(D_PRINTF("Dispatcher: Running dispatched function. Left: %lu\r\n", dispatched.size()));
-    callback();
+    auto &statistics = worker.statistics;
+    statistics.isr_queue_high_water = std::max(statistics.isr_queue_high_water, isr_events.size());
+    if (!isr_events.pop(event)) return false;
+
+    VERBOSE(D_PRINTF("Dispatcher: Worker %u running ISR event. Left: %lu\r\n", worker.index, isr_events.size()));
+
+    worker.running_priority = Priority::URGENT;
+
+    const auto started_at = (uint32_t) esp_timer_get_time();
+    event.handler(event);
+
+    worker.running_priority = Priority::NORMAL;
+    record_execution(worker, event.timestamp, started_at);
+
+    return true;
+}
+
+bool Dispatcher::process_pending_tasks(Worker &worker) {
+    Task task;
+
+    for (uint32_t i = 0; i < DISPATCHER_BATCH_SIZE; ++i) {
+        if (run_isr_event(worker)) {
+            ++worker.processed_tasks;
+            continue;
+        }
+
+        if (!pop_next(worker, task)) return false;
+
+        VERBOSE(D_PRINTF("Dispatcher: Worker %u running dispatched function (%s). Left: %lu urgent, %lu pinned, %lu normal\r\n",
+            worker.index, task.priority == Priority::URGENT ? "urgent" : "normal",
+            worker.lane(Priority::URGENT).size(), worker.pinned.size(), worker.lane(Priority::NORMAL).size()));
+
+        run_task(worker, task);
+        ++worker.processed_tasks;
+    }
+
+    return has_pending_task(worker);
+}
+
+void Dispatcher::run_task(Worker &worker, Task &task) {
+    worker.running_priority = task.priority;
+
+    const auto started_at = (uint32_t) esp_timer_get_time();
+    task.fn();
+
+    worker.running_priority = Priority::NORMAL;
+    record_execution(worker, task.enqueued_at, started_at);
+}
+
+void Dispatcher::record_execution(Worker &worker, uint32_t enqueued_at, uint32_t started_at) {
+    const uint32_t execution_time = (uint32_t) esp_timer_get_time() - started_at;
+
+    auto &statistics = worker.statistics;
+    ++statistics.processed;
+    statistics.latency_micros.add(started_at - enqueued_at);
+    statistics.execution_micros.add(execution_time);
+    statistics.total_execution_micros += execution_time;
+    statistics.max_execution_micros = std::max(statistics.max_execution_micros, execution_time);
+}
+
+bool Dispatcher::pop_next(Worker &worker, Task &out) {
+    auto &statistics = worker.statistics;
+    auto &urgent_high_water = statistics.queue_high_water[(uint8_t) Priority::URGENT];
+    auto &normal_high_water = statistics.queue_high_water[(uint8_t) Priority::NORMAL];
+
+    // Let normal lanes make progress after a long series of urgent functions
+    if (worker.urgent_streak >= DISPATCHER_URGENT_STREAK_LIMIT) {
+        worker.urgent_streak = 0;
+
+        if (pop_from(worker, worker.pinned, worker.pinned_overflow, statistics.pinned_queue_high_water, out)) return true;
+        if (pop_from(worker, worker.lane(Priority::NORMAL), worker.overflow(false, Priority::NORMAL), normal_high_water, out)) return true;
+    }
+
+    if (pop_from(worker, worker.lane(Priority::URGENT), worker.overflow(false, Priority::URGENT), urgent_high_water, out)) {
+        ++worker.urgent_streak;
+        return true;
+    }
+
+    worker.urgent_streak = 0;
+
+    if (pop_from(worker, worker.pinned, worker.pinned_overflow, statistics.pinned_queue_high_water, out)) return true;
+    if (pop_from(worker, worker.lane(Priority::NORMAL), worker.overflow(false, Priority::NORMAL), normal_high_water, out)) return true;
+
+    return steal(worker, out);
+}
+
+bool Dispatcher::steal(Worker &worker, Task &out) {
+    if (DISPATCHER_WORKER_COUNT == 1) return false;
+
+    for (const auto priority: {Priority::URGENT, Priority::NORMAL}) {
+        for (uint8_t i = 1; i < DISPATCHER_WORKER_COUNT; ++i) {
+            auto &victim = workers[(worker.index + i) % DISPATCHER_WORKER_COUNT];
+            if (!victim.lane(priority).pop(out)) continue;
+
+            ++worker.statistics.stolen;
+            return true;
+        }
+    }
+
+    return false;
+}
 
-    return !empty;
+bool Dispatcher::has_pending_task(Worker &worker) {
+    return !isr_events.empty()
+           || !worker.lane(Priority::URGENT).empty()
+           || !worker.pinned.empty()
+           || !worker.lane(Priority::NORMAL).empty()
+           || worker.lane_overflows[0].size.load(std::memory_order_acquire) != 0
+           || worker.lane_overflows[1].size.load(std::memory_order_acquire) != 0
+           || worker.pinned_overflow.size.load(std::memory_order_acquire) != 0;
 }
 
-void Dispatcher::delay_if_too_long() {
-    if (esp_timer_get_time() - begin_processing_micros > DISPATCHER_TASK_RUNNING_TIMEOUT_MICRO) {
+void Dispatcher::delay_if_too_long(Worker &worker) {
+    if (esp_timer_get_time() - worker.begin_processing_micros > DISPATCHER_TASK_RUNNING_TIMEOUT_MICRO) {
         vTaskDelay(0);
+        ++worker.statistics.yields;
 
         VERBOSE(D_PRINT("Dispatcher: Too long task execution. Wait before continue"));
-        begin_processing_micros = esp_timer_get_time();
+        worker.begin_processing_micros = esp_timer_get_time();
     } else {
         esp_task_wdt_reset();
     }
@@ -1,8 +1,13 @@
 #pragma once
 
 #include <Arduino.h>
-#include <functional>
-#include <queue>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "../misc/histogram.h"
+#include "../misc/inplace_function.h"
+#include "../misc/mpmc_queue.h"
 
 #ifndef DISPATCHER_STACK_SIZE
 #define DISPATCHER_STACK_SIZE                               (4096u)
@@ -12,20 +17,168 @@
 #define DISPATCHER_TASK_PRIORITY                            (1u)
 #endif
 
+// Count of worker tasks. Workers are spread across available cores, starting from the core calling ::begin()
+#ifndef DISPATCHER_WORKER_COUNT
+#define DISPATCHER_WORKER_COUNT                             (1u)
+#endif
+
 #ifndef DISPATCHER_TASK_RUNNING_TIMEOUT_MICRO
 #define DISPATCHER_TASK_RUNNING_TIMEOUT_MICRO               (100)
 #endif
 
+#ifndef DISPATCHER_FN_CAPACITY
+#define DISPATCHER_FN_CAPACITY                              (20 * sizeof(void *))
+#endif
+
+// Size of each priority lane. Must be a power of two. Functions beyond that wait in allocated overflow list,
+// only ISR context can't use it and gets its functions dropped
+#ifndef DISPATCHER_QUEUE_SIZE
+#define DISPATCHER_QUEUE_SIZE                               (32u)
+#endif
+
+// Size of per-worker lane for pinned functions. Must be a power of two
+#ifndef DISPATCHER_PINNED_QUEUE_SIZE
+#define DISPATCHER_PINNED_QUEUE_SIZE                        (16u)
+#endif
+
+// Max nesting of functions executed in place by ::dispatch_inline(). 0 disables inline execution
+#ifndef DISPATCHER_INLINE_DEPTH_LIMIT
+#define DISPATCHER_INLINE_DEPTH_LIMIT                       (4u)
+#endif
+
+// Size of event pool shared by ::dispatch_from_isr() callers. Must be a power of two
+#ifndef DISPATCHER_ISR_QUEUE_SIZE
+#define DISPATCHER_ISR_QUEUE_SIZE                           (16u)
+#endif
+
+#ifndef DISPATCHER_ISR_PAYLOAD_SIZE
+#define DISPATCHER_ISR_PAYLOAD_SIZE                         (8u)
+#endif
+
+// Max count of urgent functions in a row while normal ones are waiting
+#ifndef DISPATCHER_URGENT_STREAK_LIMIT
+#define DISPATCHER_URGENT_STREAK_LIMIT                      (8u)
+#endif
+
+#ifndef DISPATCHER_BATCH_SIZE
+#define DISPATCHER_BATCH_SIZE                               (8u)
+#endif
+
+#ifndef DISPATCHER_STATS_HISTOGRAM_SIZE
+#define DISPATCHER_STATS_HISTOGRAM_SIZE                     (16u)
+#endif
+
+struct DispatcherStats {
+    uint32_t dispatched = 0;
+    // Functions which found their lane full and went to overflow list
+    uint32_t overflowed = 0;
+    uint32_t dropped = 0;
+    uint32_t processed = 0;
+
+    uint32_t stolen = 0;
+    uint32_t inlined = 0;
+
+    uint32_t wakeups = 0;
+    uint32_t yields = 0;
+    uint32_t last_tasks_per_wake = 0;
+    uint32_t max_tasks_per_wake = 0;
+
+    // Indexed by Dispatcher::Priority
+    uint32_t queue_high_water[2] {};
+    uint32_t pinned_queue_high_water = 0;
+
+    uint32_t isr_dispatched = 0;
+    uint32_t isr_dropped = 0;
+    uint32_t isr_queue_high_water = 0;
+
+    uint64_t total_execution_micros = 0;
+    uint32_t max_execution_micros = 0;
+
+    Log2Histogram<DISPATCHER_STATS_HISTOGRAM_SIZE> latency_micros;
+    Log2Histogram<DISPATCHER_STATS_HISTOGRAM_SIZE> execution_micros;
+};
+
+/**
+ * Preallocated record passed from ISR to dispatcher worker: handler, small POD payload and time of the event.
+ */
+struct DispatcherIsrEvent {
+    using Handler = void (*)(const DispatcherIsrEvent &event);
+
+    Handler handler = nullptr;
+    uint32_t timestamp = 0;
+
+    alignas(uint32_t) uint8_t payload[DISPATCHER_ISR_PAYLOAD_SIZE] {};
+
+    template<typename T>
+    [[nodiscard]] T payload_as() const;
+};
+
 class Dispatcher {
-    using PrivateDispatchFn = std::function<void()>;
+public:
+    enum class Priority : uint8_t {
+        NORMAL = 0,
+        URGENT = 1,
+    };
 
-    static bool initialized;
-    static uint64_t begin_processing_micros;
-    static int processed_tasks;
-    static TaskHandle_t task_handle;
+    static constexpr uint8_t NO_WORKER = 0xff;
+
+private:
+    using PrivateDispatchFn = InplaceFunction<void(), DISPATCHER_FN_CAPACITY>;
+
+    struct Task {
+        PrivateDispatchFn fn;
+        uint32_t enqueued_at;
+        Priority priority;
+    };
+
+    using Lane = MpmcQueue<Task, DISPATCHER_QUEUE_SIZE>;
+    using PinnedLane = MpmcQueue<Task, DISPATCHER_PINNED_QUEUE_SIZE>;
+
+    struct OverflowNode {
+        Task task;
+        OverflowNode *next = nullptr;
+    };
+
+    // Continuation of a full lane. While it isn't empty, new functions of the lane go here as well to keep their order
+    struct Overflow {
+        OverflowNode *head = nullptr;
+        OverflowNode *tail = nullptr;
+        std::atomic<uint32_t> size {0};
+    };
+
+    struct Worker {
+        uint8_t index = 0;
+        TaskHandle_t task_handle = nullptr;
+        std::atomic<bool> idle {false};
+
+        // Shared lanes, other workers steal from them when run out of work
+        Lane lanes[2];
+        // Functions pinned to this worker, never stolen
+        PinnedLane pinned;
 
+        portMUX_TYPE overflow_spinlock = portMUX_INITIALIZER_UNLOCKED;
+        Overflow lane_overflows[2];
+        Overflow pinned_overflow;
+
+        Priority running_priority = Priority::NORMAL;
+        uint32_t urgent_streak = 0;
+        uint8_t inline_depth = 0;
+
+        uint64_t begin_processing_micros = 0;
+        int processed_tasks = 0;
+
+        DispatcherStats statistics;
+
+        Lane &lane(Priority priority) { return lanes[(uint8_t) priority]; }
+        Overflow &overflow(bool is_pinned, Priority priority) { return is_pinned ? pinned_overflow : lane_overflows[(uint8_t) priority]; }
+    };
+
+    using IsrQueue = MpmcQueue<DispatcherIsrEvent, DISPATCHER_ISR_QUEUE_SIZE>;
+
+    static bool initialized;
     static portMUX_TYPE spinlock;
-    static std::queue<PrivateDispatchFn> dispatched;
+    static Worker workers[DISPATCHER_WORKER_COUNT];
+    static IsrQueue isr_events;
 
 public:
     using DispatchFn = PrivateDispatchFn;
@@ -33,15 +186,96 @@ public:
     Dispatcher() = delete;
 
     static bool begin();
-    static bool dispatch(DispatchFn fn);
+    static bool dispatch(DispatchFn fn, Priority priority = Priority::NORMAL);
+
+    // Functions pinned to the same worker are never stolen, so they run in dispatch order
+    static bool dispatch_to(uint8_t worker, DispatchFn fn, Priority priority = Priority::NORMAL);
+
+    // Run function in place when called from dispatcher worker and nesting limit allows it, dispatch otherwise.
+    // Normal functions aren't executed in place while urgent ones are waiting
+    static bool dispatch_inline(DispatchFn fn, Priority priority = Priority::NORMAL, uint8_t worker = NO_WORKER);
+
+    // Allocation free hand off from ISR or time-critical callbacks. Handler runs on dispatcher worker ahead of urgent functions
+    static bool dispatch_from_isr(DispatcherIsrEvent::Handler handler) { return push_isr_event(handler, nullptr, 0); }
+
+    template<typename T>
+    static bool dispatch_from_isr(DispatcherIsrEvent::Handler handler, const T &payload);
+
+    static constexpr uint8_t worker_count() { return DISPATCHER_WORKER_COUNT; }
+    // Stable worker for the key, e.g. pin all processing of one peer to keep its order
+    static uint8_t worker_for(uint64_t key);
+
+    // Index of the worker executing current function, NO_WORKER when called outside of dispatcher
+    static uint8_t current_worker();
+
+    // Priority of the function being executed by dispatcher worker, NORMAL when called outside of it
+    static Priority current_priority();
+
+    // Stats summed over all workers
+    static DispatcherStats stats();
+    static DispatcherStats stats(uint8_t worker);
+    static void reset_stats();
 
 private:
-    static bool notify_from_isr();
-    static bool notify();
+    static std::atomic<uint32_t> dispatched_count;
+    static std::atomic<uint32_t> overflowed_count;
+    static std::atomic<uint32_t> dropped_count;
+    static std::atomic<uint32_t> next_worker;
+    static std::atomic<uint32_t> isr_dispatched_count;
+    static std::atomic<uint32_t> isr_dropped_count;
+
+    static Worker *worker_of_current_task();
+    static Worker &select_worker();
+
+    static bool can_run_inline(Worker &current, Priority priority, uint8_t worker);
+    static bool submit(Worker &worker, bool pinned, DispatchFn &fn, Priority priority);
+    static bool enqueue(Worker &worker, bool pinned, DispatchFn &fn, Priority priority);
+    static void push_overflow(Worker &worker, Overflow &overflow, Task &&task);
+    static bool pop_overflow(Worker &worker, Overflow &overflow, Task &out);
+    static void wake_up(Worker &worker);
+    static void wake_up_any();
+    static bool notify_from_isr(Worker &worker);
+    static bool notify(Worker &worker);
 
-    static void dispatcher_task(void *);
+    [[noreturn]] static void dispatcher_task(void *arg);
 
-    static bool process_pending_tasks();
-    static bool has_pending_task();
-    static void delay_if_too_long();
+    static bool push_isr_event(DispatcherIsrEvent::Handler handler, const void *payload, uint8_t size);
+    static bool run_isr_event(Worker &worker);
+
+    static bool process_pending_tasks(Worker &worker);
+    static bool pop_next(Worker &worker, Task &out);
+    static bool steal(Worker &worker, Task &out);
+    static void run_task(Worker &worker, Task &task);
+    static void record_execution(Worker &worker, uint32_t enqueued_at, uint32_t started_at);
+    static bool has_pending_task(Worker &worker);
+    static void delay_if_too_long(Worker &worker);
+
+    template<typename Queue>
+    static bool pop_from(Worker &worker, Queue &queue, Overflow &overflow, uint32_t &high_water, Task &out);
 };
+
+template<typename T>
+T DispatcherIsrEvent::payload_as() const {
+    static_assert(std::is_trivially_copyable_v<T>, "DispatcherIsrEvent: payload must be trivially copyable");
+    static_assert(sizeof(T) <= DISPATCHER_ISR_PAYLOAD_SIZE, "DispatcherIsrEvent: payload is too big");
+
+    T result;
+    memcpy(&result, payload, sizeof(T));
+    return result;
+}
+
+template<typename T>
+bool Dispatcher::dispatch_from_isr(DispatcherIsrEvent::Handler handler, const T &payload) {
+    static_assert(std::is_trivially_copyable_v<T>, "Dispatcher: ISR payload must be trivially copyable");
+    static_assert(sizeof(T) <= DISPATCHER_ISR_PAYLOAD_SIZE, "Dispatcher: ISR payload is too big");
+
+    return push_isr_event(handler, &payload, sizeof(T));
+}
+
+template<typename Queue>
+bool Dispatcher::pop_from(Worker &worker, Queue &queue, Overflow &overflow, uint32_t &high_water, Task &out) {
+    high_water = std::max(high_water, queue.size() + overflow.size.load(std::memory_order_relaxed));
+
+    // Lane holds older functions than its overflow
+    return queue.pop(out) || pop_overflow(worker, overflow, out);
+}
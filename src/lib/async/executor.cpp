@@ -0,0 +1,106 @@
+#include "executor.h"
+
+#include "../debug.h"
+
+InlineExecutor &InlineExecutor::instance() {
+    static InlineExecutor executor;
+    return executor;
+}
+
+bool InlineExecutor::execute(ExecutorFn fn, Dispatcher::Priority) {
+    fn();
+    return true;
+}
+
+DispatcherExecutor &DispatcherExecutor::instance() {
+    static DispatcherExecutor executor;
+    return executor;
+}
+
+bool DispatcherExecutor::execute(ExecutorFn fn, Dispatcher::Priority priority) {
+    return Dispatcher::dispatch(std::move(fn), priority);
+}
+
+bool WorkerExecutor::execute(ExecutorFn fn, Dispatcher::Priority priority) {
+    return Dispatcher::dispatch_to(_worker, std::move(fn), priority);
+}
+
+LoopExecutor &LoopExecutor::instance() {
+    static LoopExecutor executor;
+    return executor;
+}
+
+bool LoopExecutor::execute(ExecutorFn fn, Dispatcher::Priority) {
+    if (_queue.push(std::move(fn))) return true;
+
+    D_PRINT("LoopExecutor: Queue is full. Dropping function");
+    return false;
+}
+
+void LoopExecutor::run() {
+    ExecutorFn fn;
+    for (auto count = _queue.size(); count > 0 && _queue.pop(fn); --count) {
+        fn();
+        fn = nullptr;
+    }
+}
+
+TaskPoolExecutor::TaskPoolExecutor(const char *name, uint8_t task_count, uint32_t stack_size, UBaseType_t priority) :
+    _name(name), _task_count(task_count), _stack_size(stack_size), _priority(priority) {}
+
+bool TaskPoolExecutor::begin() {
+    if (_initialized) return true;
+
+    _pending = xSemaphoreCreateCounting(TASK_POOL_EXECUTOR_QUEUE_SIZE, 0);
+    if (_pending == nullptr) {
+        D_PRINTF("TaskPoolExecutor (%s): Unable to create semaphore\r\n", _name);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < _task_count; ++i) {
+        auto ret = xTaskCreate(pool_task, _name, _stack_size, this, _priority, nullptr);
+        if (ret != pdPASS) {
+            D_PRINTF("TaskPoolExecutor (%s): Failed to start task %u: %x\r\n", _name, i, ret);
+
+            // Tasks already started keep serving the queue
+            if (i == 0) return false;
+            break;
+        }
+    }
+
+    _initialized = true;
+    return true;
+}
+
+bool TaskPoolExecutor::execute(ExecutorFn fn, Dispatcher::Priority) {
+    if (!_initialized) {
+        D_PRINTF("TaskPoolExecutor (%s): Not started. Dropping function\r\n", _name);
+        return false;
+    }
+
+    if (!_queue.push(std::move(fn))) {
+        D_PRINTF("TaskPoolExecutor (%s): Queue is full. Dropping function\r\n", _name);
+        return false;
+    }
+
+    if (xPortInIsrContext()) {
+        xSemaphoreGiveFromISR(_pending, nullptr);
+    } else {
+        xSemaphoreGive(_pending);
+    }
+
+    return true;
+}
+
+void TaskPoolExecutor::pool_task(void *arg) {
+    auto &self = *(TaskPoolExecutor *) arg;
+
+    ExecutorFn fn;
+    while (true) {
+        xSemaphoreTake(self._pending, portMAX_DELAY);
+        if (!self._queue.pop(fn)) continue;
+
+        fn();
+        fn = nullptr;
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "dispatcher.h"
+#include "../misc/mpmc_queue.h"
+
+// Size of the queue drained by LoopExecutor::run(). Must be a power of two
+#ifndef LOOP_EXECUTOR_QUEUE_SIZE
+#define LOOP_EXECUTOR_QUEUE_SIZE                            (16u)
+#endif
+
+// Size of the queue shared by TaskPoolExecutor tasks. Must be a power of two
+#ifndef TASK_POOL_EXECUTOR_QUEUE_SIZE
+#define TASK_POOL_EXECUTOR_QUEUE_SIZE                       (16u)
+#endif
+
+#ifndef TASK_POOL_EXECUTOR_STACK_SIZE
+#define TASK_POOL_EXECUTOR_STACK_SIZE                       (4096u)
+#endif
+
+#ifndef TASK_POOL_EXECUTOR_TASK_PRIORITY
+#define TASK_POOL_EXECUTOR_TASK_PRIORITY                    (1u)
+#endif
+
+typedef Dispatcher::DispatchFn ExecutorFn;
+
+/**
+ * Place where future continuations run, see Future::via() and Future::then_on().
+ * Executors must outlive the futures using them, so they are usually static.
+ */
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // Priority is a hint, only executors backed by Dispatcher use it. Returns false if function was dropped
+    virtual bool execute(ExecutorFn fn, Dispatcher::Priority priority) = 0;
+};
+
+// Runs function right in the context that resolved the promise, which may be radio callback or ISR.
+// Only for short, non-blocking bookkeeping
+class InlineExecutor final : public Executor {
+public:
+    static InlineExecutor &instance();
+
+    bool execute(ExecutorFn fn, Dispatcher::Priority priority) override;
+};
+
+// Any Dispatcher worker, the same as continuations without executor but never executed in place
+class DispatcherExecutor final : public Executor {
+public:
+    static DispatcherExecutor &instance();
+
+    bool execute(ExecutorFn fn, Dispatcher::Priority priority) override;
+};
+
+// Specific Dispatcher worker, and so the core it is pinned to. Functions run in submission order
+class WorkerExecutor final : public Executor {
+    uint8_t _worker;
+
+public:
+    explicit WorkerExecutor(uint8_t worker) : _worker(worker) {}
+
+    bool execute(ExecutorFn fn, Dispatcher::Priority priority) override;
+};
+
+// Defers functions to the next ::run(), called from Arduino loop(). For APIs usable from Arduino task only
+class LoopExecutor final : public Executor {
+    MpmcQueue<ExecutorFn, LOOP_EXECUTOR_QUEUE_SIZE> _queue;
+
+public:
+    static LoopExecutor &instance();
+
+    bool execute(ExecutorFn fn, Dispatcher::Priority priority) override;
+
+    // Runs functions queued before the call, functions queued by them wait for the next one
+    void run();
+};
+
+// Own pool of FreeRTOS tasks for heavy or blocking work, so it doesn't delay Dispatcher
+class TaskPoolExecutor final : public Executor {
+    const char *_name;
+    uint8_t _task_count;
+    uint32_t _stack_size;
+    UBaseType_t _priority;
+
+    bool _initialized = false;
+    SemaphoreHandle_t _pending = nullptr;
+    MpmcQueue<ExecutorFn, TASK_POOL_EXECUTOR_QUEUE_SIZE> _queue;
+
+public:
+    explicit TaskPoolExecutor(const char *name, uint8_t task_count = 1,
+        uint32_t stack_size = TASK_POOL_EXECUTOR_STACK_SIZE, UBaseType_t priority = TASK_POOL_EXECUTOR_TASK_PRIORITY);
+
+    TaskPoolExecutor(const TaskPoolExecutor &) = delete;
+    TaskPoolExecutor &operator=(TaskPoolExecutor const &) = delete;
+
+    bool begin();
+
+    bool execute(ExecutorFn fn, Dispatcher::Priority priority) override;
+
+private:
+    [[noreturn]] static void pool_task(void *arg);
+};
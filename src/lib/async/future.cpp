@@ -5,12 +5,43 @@ bool FutureBase::has_result() const { return promise->has_result(); }
 bool FutureBase::finished() const { return promise->finished(); }
 bool FutureBase::success() const { return promise->success(); }
 
-bool FutureBase::wait(unsigned long timeout, unsigned long delay_interval) const {
-    return promise->wait(timeout, delay_interval);
+bool FutureBase::wait(unsigned long timeout) const {
+    return promise->wait(timeout);
 }
 
-void FutureBase::on_finished(FutureFinishedCb callback) const {
-    const_cast<PromiseBase &>(*promise).on_finished(std::move(callback));
+bool FutureBase::wait_until(unsigned long deadline) const {
+    return promise->wait_until(deadline);
+}
+
+void FutureBase::on_finished(FutureFinishedCb callback, Executor *executor) const {
+    const_cast<PromiseBase &>(*promise).on_finished(std::move(callback), executor);
+}
+
+bool FutureBase::cancel() const {
+    return const_cast<PromiseBase &>(*promise).cancel();
+}
+
+void FutureBase::cancel_weak(const std::weak_ptr<const PromiseBase> &promise) {
+    if (const auto upstream = promise.lock()) const_cast<PromiseBase &>(*upstream).cancel();
+}
+
+unsigned long FutureBase::deadline() const { return promise->deadline(); }
+bool FutureBase::expired() const { return promise->expired(); }
+
+void FutureBase::set_deadline(unsigned long deadline, unsigned long slack) const {
+    PromiseBase::set_deadline(std::const_pointer_cast<PromiseBase>(promise), deadline, slack);
+}
+
+void FutureBase::enforce_deadline() const {
+    PromiseBase::enforce_deadline(std::const_pointer_cast<PromiseBase>(promise));
+}
+
+unsigned long FutureBase::deadline_after(unsigned long timeout) {
+    if (timeout == 0) return 0;
+
+    // Zero means no deadline, wrapped millis() may hit it
+    const auto deadline = millis() + timeout;
+    return deadline != 0 ? deadline : 1;
 }
 
 Future<void>::Future(const std::shared_ptr<Promise<void>> &promise) : FutureBase(promise) {}
@@ -29,33 +60,54 @@ Future<void> Future<void>::errored() {
     return promise;
 }
 
-Future<void> Future<void>::on_error(std::function<Future()> fn) const {
-    return FutureBase::on_error<void>(*this, [fn=std::move(fn)](auto) {
+Future<void> Future<void>::on_error(FutureContinuation<Future()> fn) const {
+    return FutureBase::on_error(*this, [fn=std::move(fn)](auto) {
         return fn();
     });
 }
 
-Future<void> Future<void>::on_error(std::function<void()> fn) const {
-    return FutureBase::on_error<void>(*this, [fn=std::move(fn)](auto f) {
+Future<void> Future<void>::on_error(FutureContinuation<void()> fn) const {
+    return FutureBase::on_error(*this, [fn=std::move(fn)](auto f) {
         fn();
         return f;
     });
 }
 
-Future<void> Future<void>::on_error(std::function<Future(const Future &)> fn) const {
+Future<void> Future<void>::on_error(FutureContinuation<Future(const Future &)> fn) const {
     return FutureBase::on_error(*this, std::move(fn));
 }
 
-Future<void> Future<void>::finally(std::function<void()> fn) const {
-    return FutureBase::finally<void>(*this, [fn=std::move(fn)](auto) {
+Future<void> Future<void>::finally(FutureContinuation<void()> fn) const {
+    return FutureBase::finally(*this, [fn=std::move(fn)](auto) {
         fn();
     });
 }
 
-Future<void> Future<void>::finally(std::function<void(const Future &)> fn) const {
+Future<void> Future<void>::finally(FutureContinuation<void(const Future &)> fn) const {
     return FutureBase::finally(*this, std::move(fn));
 }
 
-Future<void> Future<void>::with_timeout(unsigned long timeout) const {
-    return FutureBase::with_timeout(*this, timeout);
+Future<void> Future<void>::with_timeout(unsigned long timeout, unsigned long slack) const {
+    return FutureBase::with_deadline(*this, deadline_after(timeout), slack);
+}
+
+Future<void> Future<void>::with_deadline(unsigned long deadline, unsigned long slack) const {
+    return FutureBase::with_deadline(*this, deadline, slack);
+}
+
+Future<void> Future<void>::cancel_at(unsigned long deadline, unsigned long slack) const {
+    set_deadline(deadline, slack);
+    return *this;
+}
+
+Future<void> Future<void>::cancel_after(unsigned long timeout, unsigned long slack) const {
+    return cancel_at(deadline_after(timeout), slack);
+}
+
+Future<void> Future<void>::with_cancellation(const CancellationToken &token) const {
+    return FutureBase::with_cancellation(*this, token);
+}
+
+Future<void> Future<void>::via(Executor &executor) const {
+    return FutureBase::via(*this, executor);
 }
@@ -1,10 +1,22 @@
 #pragma once
 
-#include <functional>
 #include <memory>
+#include <type_traits>
+#include <variant>
 
+#include "cancellation_token.h"
+#include "executor.h"
 #include "system_timer.h"
 #include "../debug.h"
+#include "../misc/inplace_function.h"
+
+#ifndef FUTURE_CONTINUATION_CAPACITY
+#define FUTURE_CONTINUATION_CAPACITY                        (8 * sizeof(void *))
+#endif
+
+#ifndef FUTURE_FINISHED_CB_CAPACITY
+#define FUTURE_FINISHED_CB_CAPACITY                         (16 * sizeof(void *))
+#endif
 
 class SystemTimer;
 
@@ -13,7 +25,11 @@ class PromiseBase;
 template<typename T> class Future;
 template<typename T> class Promise;
 
-typedef std::function<void(bool success)> FutureFinishedCb;
+typedef InplaceFunction<void(bool success), FUTURE_FINISHED_CB_CAPACITY> FutureFinishedCb;
+template<typename Signature> using FutureContinuation = InplaceFunction<Signature, FUTURE_CONTINUATION_CAPACITY>;
+
+// Result of Future<T> as a regular type, void becomes std::monostate
+template<typename T> using FutureValue = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
 
 class FutureBase {
 protected:
@@ -28,17 +44,43 @@ public:
     [[nodiscard]] bool finished() const;
     [[nodiscard]] bool success() const;
 
-    [[nodiscard]] bool wait(unsigned long timeout = 0, unsigned long delay_interval = 1) const;
-    void on_finished(FutureFinishedCb callback) const;
+    // Blocks calling task until finished without polling. Returns false on timeout
+    [[nodiscard]] bool wait(unsigned long timeout = 0) const;
+    [[nodiscard]] bool wait_until(unsigned long deadline) const;
+    void on_finished(FutureFinishedCb callback, Executor *executor = nullptr) const;
+
+    // Rejects pending future and asks its producer to stop. Chained futures pass cancellation to the futures
+    // they are waiting for, so cancelling the end of a chain stops the pending step.
+    // Returns false if future already finished
+    bool cancel() const; // NOLINT(*-use-nodiscard)
+
+    // For cancel handlers of derived promises: holding upstream weakly, chain and upstream never own each other
+    [[nodiscard]] std::weak_ptr<const PromiseBase> weak_promise() const { return promise; }
+    static void cancel_weak(const std::weak_ptr<const PromiseBase> &promise);
+
+    // See PromiseBase::deadline()
+    [[nodiscard]] unsigned long deadline() const;
+    [[nodiscard]] bool expired() const;
 
 protected:
-    template<typename T, typename R> static Future<R> then(const Future<T> &future, std::function<Future<R>(const Future<T> &)> fn);
-    template<typename T, typename R> static Future<R> then(const Future<T> &future, std::function<R(const Future<T> &)> fn);
+    template<typename T, typename R> static Future<R> then(const Future<T> &future, FutureContinuation<Future<R>(const Future<T> &)> fn);
+    template<typename T, typename R> static Future<R> then(const Future<T> &future, FutureContinuation<R(const Future<T> &)> fn);
+
+    template<typename T, typename Fn> static Future<T> on_error(const Future<T> &future, Fn fn);
+    template<typename T, typename Fn> static Future<T> finally(const Future<T> &future, Fn fn);
 
-    template<typename T> static Future<T> on_error(const Future<T> &future, std::function<Future<T>(const Future<T> &)> fn);
-    template<typename T> static Future<T> finally(const Future<T> &future, std::function<void(const Future<T> &)> fn);
+    template<typename T> static Future<T> with_deadline(const Future<T> &future, unsigned long deadline, unsigned long slack);
+    template<typename T> static Future<T> with_cancellation(const Future<T> &future, const CancellationToken &token);
+    template<typename T> static Future<T> via(const Future<T> &future, Executor &executor);
 
-    template<typename T> static Future<T> with_timeout(const Future<T> &future, unsigned long timeout);
+    void set_deadline(unsigned long deadline, unsigned long slack) const;
+    // See PromiseBase::enforce_deadline()
+    void enforce_deadline() const;
+
+    // Absolute millis() deadline of timeout, 0 for no timeout
+    static unsigned long deadline_after(unsigned long timeout);
+
+    template<typename T> static void forward_result(const Future<T> &from, const std::shared_ptr<Promise<T>> &to, bool success);
 };
 
 template<typename T>
@@ -47,21 +89,48 @@ public:
     Future(const std::shared_ptr<Promise<T>> &promise); // NOLINT(*-explicit-constructor)
 
     [[nodiscard]] T result() const;
+    [[nodiscard]] const T &result_ref() const;
+
+    // Moves result out of the promise, so other futures of the same promise can't read it anymore
+    [[nodiscard]] T take() const;
+
+    // Moves result out if nothing else references the promise, copies it otherwise
+    [[nodiscard]] T consume() const;
 
     static Future successful(T value);
     static Future errored();
 
-    template<typename R> Future<R> then(std::function<Future<R>(const Future &)> fn);
-    template<typename R> Future<R> then(std::function<R(const Future &)> fn);
+    template<typename R> Future<R> then(FutureContinuation<Future<R>(const Future &)> fn);
+    template<typename R> Future<R> then(FutureContinuation<R(const Future &)> fn);
+
+    // Same as then(), but continuation runs on executor
+    template<typename R> Future<R> then_on(Executor &executor, FutureContinuation<Future<R>(const Future &)> fn) const;
+    template<typename R> Future<R> then_on(Executor &executor, FutureContinuation<R(const Future &)> fn) const;
+
+    // Same outcome, continuations attached to the returned future run on executor
+    Future via(Executor &executor) const;
 
-    Future on_error(std::function<Future(const Future &)> fn) const;
-    Future on_error(std::function<Future()> fn) const;
-    Future on_error(std::function<void()> fn) const;
+    Future on_error(FutureContinuation<Future(const Future &)> fn) const;
+    Future on_error(FutureContinuation<Future()> fn) const;
+    Future on_error(FutureContinuation<void()> fn) const;
 
-    Future finally(std::function<void(const Future &)> fn) const;
-    Future finally(std::function<void()> fn) const;
+    Future finally(FutureContinuation<void(const Future &)> fn) const;
+    Future finally(FutureContinuation<void()> fn) const;
 
-    Future with_timeout(unsigned long timeout) const;
+    // Derived future failing when timeout expires, this one and its other holders aren't affected.
+    // Timeout may expire up to slack ms later, so it can share wakeup with other timers
+    Future with_timeout(unsigned long timeout, unsigned long slack = 0) const;
+
+    // Same as with_timeout(), but with absolute millis() deadline. Operations chained to the result inherit it
+    Future with_deadline(unsigned long deadline, unsigned long slack = 0) const;
+
+    // Cancels this very future at deadline, for every holder of it. Only for futures owned by the caller.
+    // No promise is allocated, and no timer is set when the future already has a tighter deadline
+    Future cancel_at(unsigned long deadline, unsigned long slack = 0) const;
+    Future cancel_after(unsigned long timeout, unsigned long slack = 0) const;
+
+    // Cancels this future when token is cancelled
+    Future with_cancellation(const CancellationToken &token) const;
 };
 
 template<>
@@ -74,33 +143,53 @@ public:
     static Future successful();
     static Future errored();
 
-    template<typename R> Future<R> then(std::function<Future<R>(const Future &)> fn);
-    template<typename R> Future<R> then(std::function<R(const Future &)> fn);
+    template<typename R> Future<R> then(FutureContinuation<Future<R>(const Future &)> fn);
+    template<typename R> Future<R> then(FutureContinuation<R(const Future &)> fn);
+
+    template<typename R> Future<R> then_on(Executor &executor, FutureContinuation<Future<R>(const Future &)> fn) const;
+    template<typename R> Future<R> then_on(Executor &executor, FutureContinuation<R(const Future &)> fn) const;
+
+    Future via(Executor &executor) const;
+
+    Future on_error(FutureContinuation<Future(const Future &)> fn) const;
+    Future on_error(FutureContinuation<Future()> fn) const;
+    Future on_error(FutureContinuation<void()> fn) const;
 
-    Future on_error(std::function<Future(const Future &)> fn) const;
-    Future on_error(std::function<Future()> fn) const;
-    Future on_error(std::function<void()> fn) const;
+    Future finally(FutureContinuation<void()> fn) const;
+    Future finally(FutureContinuation<void(const Future &)> fn) const;
 
-    Future finally(std::function<void()> fn) const;
-    Future finally(std::function<void(const Future &)> fn) const;
+    Future with_timeout(unsigned long timeout, unsigned long slack = 0) const;
+    Future with_deadline(unsigned long deadline, unsigned long slack = 0) const;
 
-    Future with_timeout(unsigned long timeout) const;
+    Future cancel_at(unsigned long deadline, unsigned long slack = 0) const;
+    Future cancel_after(unsigned long timeout, unsigned long slack = 0) const;
+
+    Future with_cancellation(const CancellationToken &token) const;
 };
 
-template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &future, std::function<Future<R>(const Future<T> &)> fn) {
+template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &future, FutureContinuation<Future<R>(const Future<T> &)> fn) {
     VERBOSE(D_PRINTF("Promise (%p): Set continuation (promise)\n", future.promise.get()));
 
     auto chained_promise = Promise<R>::create();
+    chained_promise->inherit_deadline(future.deadline());
+    chained_promise->set_cancel_handler([upstream = future.weak_promise()] { cancel_weak(upstream); });
+
     future.on_finished([self = future, fn = std::move(fn), chained_promise](bool success) {
+        // Cancelled or expired chain doesn't start new work
+        if (chained_promise->finished() || (chained_promise->expired() && chained_promise->cancel())) return;
+
         if (success) {
+            // Nested future may be shared, so it gets neither the deadline nor cancellation on expiration,
+            // the chain expires alone. Explicit cancellation still goes upstream
             auto ret_future = fn(self);
+            chained_promise->set_cancel_handler([raw_chained = chained_promise.get(), upstream = ret_future.weak_promise()] {
+                if (!raw_chained->expired()) cancel_weak(upstream);
+            });
+
+            if (ret_future.deadline() != chained_promise->deadline()) Future<R>(chained_promise).enforce_deadline();
+
             ret_future.on_finished([ret_future, chained_promise](bool inner_success) {
-                if (inner_success) {
-                    if constexpr (std::is_void_v<R>) chained_promise->set_success();
-                    else chained_promise->set_success(ret_future.result());
-                } else {
-                    chained_promise->set_error();
-                }
+                forward_result(ret_future, chained_promise, inner_success);
             });
         } else {
             chained_promise->set_error();
@@ -110,11 +199,16 @@ template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &fut
     return chained_promise;
 }
 
-template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &future, std::function<R(const Future<T> &)> fn) {
+template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &future, FutureContinuation<R(const Future<T> &)> fn) {
     VERBOSE(D_PRINTF("Promise (%p): Set continuation (non-promise)\n", future.promise.get()));
 
     auto chained_promise = Promise<R>::create();
+    chained_promise->inherit_deadline(future.deadline());
+    chained_promise->set_cancel_handler([upstream = future.weak_promise()] { cancel_weak(upstream); });
+
     future.on_finished([self = future, fn = std::move(fn), chained_promise](bool success) {
+        if (chained_promise->finished() || (chained_promise->expired() && chained_promise->cancel())) return;
+
         if (success) {
             if constexpr (std::is_void_v<R>) {
                 fn(self);
@@ -130,37 +224,33 @@ template<typename T, typename R> Future<R> FutureBase::then(const Future<T> &fut
     return chained_promise;
 }
 
-template<typename T> Future<T> FutureBase::on_error(const Future<T> &future, std::function<Future<T>(const Future<T> &)> fn) {
+template<typename T, typename Fn> Future<T> FutureBase::on_error(const Future<T> &future, Fn fn) {
     VERBOSE(D_PRINTF("Promise (%p): Set error handler\n", future.promise.get()));
 
     auto chained_promise = Promise<T>::create();
+    chained_promise->set_cancel_handler([upstream = future.weak_promise()] { cancel_weak(upstream); });
+
+    // Error handler runs for cancelled chain as well: it usually releases resources of the failed operation.
+    // Deadline isn't inherited, handler may recover from its expiration
     future.on_finished([self = future, fn = std::move(fn), chained_promise](bool success) {
-        if (success) {
-            if constexpr (std::is_void_v<T>) chained_promise->set_success();
-            else chained_promise->set_success(self.result());
-            return;
-        }
+        if (success) return forward_result(self, chained_promise, true);
 
         auto ret_future = fn(self);
-        ret_future.on_finished([outer_future = self, ret_future, chained_promise](bool inner_success) {
-            if (inner_success) {
-                if constexpr (std::is_void_v<T>) chained_promise->set_success();
-                else chained_promise->set_success(ret_future.result());
-            } else {
-                chained_promise->set_error();
-            }
+        chained_promise->set_cancel_handler([upstream = ret_future.weak_promise()] { cancel_weak(upstream); });
+
+        ret_future.on_finished([ret_future, chained_promise](bool inner_success) {
+            forward_result(ret_future, chained_promise, inner_success);
         });
     });
 
     return chained_promise;
 }
 
-template<typename T>
-Future<T> FutureBase::finally(const Future<T> &future, std::function<void(const Future<T> &)> fn) {
+template<typename T, typename Fn>
+Future<T> FutureBase::finally(const Future<T> &future, Fn fn) {
     VERBOSE(D_PRINTF("Promise (%p): Set finally handler\n", future.promise.get()));
 
-    auto chained_promise = Promise<T>::create();
-    future.on_finished([self = future,fn = std::move(fn)](auto) {
+    future.on_finished([self = future, fn = std::move(fn)](auto) {
         fn(self);
     });
 
@@ -168,32 +258,98 @@ Future<T> FutureBase::finally(const Future<T> &future, std::function<void(const
 }
 
 template<typename T>
-Future<T> FutureBase::with_timeout(const Future<T> &future, unsigned long timeout) {
-    if (timeout == 0) return future;
+Future<T> FutureBase::with_deadline(const Future<T> &future, unsigned long deadline, unsigned long slack) {
+    if (deadline == 0) return future;
 
     auto result = Promise<T>::create();
+    result->inherit_deadline(future.deadline());
+    Future<T>(result).set_deadline(deadline, slack);
 
-    SystemTimer::set_timeout(timeout, [=] { if (!result->finished()) result->set_error(); });
+    // Only explicit cancellation goes upstream, expiration fails the derived future alone.
+    // Handler is owned by the promise, so raw pointer is valid while it runs
+    result->set_cancel_handler([raw_result = result.get(), upstream = future.weak_promise()] {
+        if (!raw_result->expired()) cancel_weak(upstream);
+    });
+
+    future.on_finished([future, result](bool success) {
+        if (result->finished()) return;
+
+        forward_result(future, result, success);
+    }, &InlineExecutor::instance());
+
+    return result;
+}
+
+template<typename T>
+Future<T> FutureBase::with_cancellation(const Future<T> &future, const CancellationToken &token) {
+    if (!token) return future;
+
+    auto result = Promise<T>::create();
+    result->inherit_deadline(future.deadline());
+    result->set_cancel_handler([upstream = future.weak_promise()] { cancel_weak(upstream); });
+
+    const auto subscription = token.subscribe([weak_result = std::weak_ptr<Promise<T>>(result)] {
+        if (auto promise = weak_result.lock()) promise->cancel();
+    });
 
     future.on_finished([=](auto success) {
+        token.unsubscribe(subscription);
         if (result->finished()) return;
 
-        if (success) {
-            if constexpr (std::is_void_v<T>) result->set_success();
-            else result->set_success(future.result());
-        } else {
-            result->set_error();
-        }
+        forward_result(future, result, success);
     });
 
     return result;
 }
 
+template<typename T>
+Future<T> FutureBase::via(const Future<T> &future, Executor &executor) {
+    auto result = Promise<T>::create();
+    result->inherit_deadline(future.deadline());
+    result->set_executor(&executor);
+    result->set_cancel_handler([upstream = future.weak_promise()] { cancel_weak(upstream); });
+
+    // Forwarding is cheap, so it runs in place and the only hop is to the executor
+    future.on_finished([future, result](bool success) {
+        if (result->finished()) return;
+
+        forward_result(future, result, success);
+    }, &InlineExecutor::instance());
+
+    return result;
+}
+
+template<typename T>
+void FutureBase::forward_result(const Future<T> &from, const std::shared_ptr<Promise<T>> &to, bool success) {
+    if (!success) {
+        to->set_error();
+    } else if constexpr (std::is_void_v<T>) {
+        to->set_success();
+    } else {
+        to->set_success(from.consume());
+    }
+}
+
 template<typename T>
 Future<T>::Future(const std::shared_ptr<Promise<T>> &promise) : FutureBase(promise) {}
 
 template<typename T>
-T Future<T>::result() const { return ((const std::shared_ptr<Promise<T>> &) promise)->result(); }
+T Future<T>::result() const { return result_ref(); }
+
+template<typename T>
+const T &Future<T>::result_ref() const { return static_cast<const Promise<T> &>(*promise).result_ref(); }
+
+template<typename T>
+T Future<T>::take() const { return const_cast<Promise<T> &>(static_cast<const Promise<T> &>(*promise)).take(); }
+
+template<typename T>
+T Future<T>::consume() const {
+    if constexpr (std::is_copy_constructible_v<T>) {
+        if (promise.use_count() > 1) return result_ref();
+    }
+
+    return take();
+}
 
 template<typename T>
 Future<T> Future<T>::errored() {
@@ -204,28 +360,26 @@ Future<T> Future<T>::errored() {
 
 template<typename T>
 template<typename R>
-Future<R> Future<T>::then(std::function<Future<R>(const Future &)> fn) { return FutureBase::then<T, R>(*this, std::move(fn)); }
+Future<R> Future<T>::then(FutureContinuation<Future<R>(const Future &)> fn) { return FutureBase::then<T, R>(*this, std::move(fn)); }
 
 template<typename T>
 template<typename R>
-Future<R> Future<T>::then(std::function<R(const Future &)> fn) { return FutureBase::then<T, R>(*this, std::move(fn)); }
+Future<R> Future<T>::then(FutureContinuation<R(const Future &)> fn) { return FutureBase::then<T, R>(*this, std::move(fn)); }
 
 template<typename T>
-Future<T> Future<T>::on_error(
-    std::function<Future(const Future &)> fn)
-const {
+Future<T> Future<T>::on_error(FutureContinuation<Future(const Future &)> fn) const {
     return FutureBase::on_error(*this, std::move(fn));
 }
 
 template<typename T>
-Future<T> Future<T>::on_error(std::function<Future()> fn) const {
+Future<T> Future<T>::on_error(FutureContinuation<Future()> fn) const {
     return FutureBase::on_error(*this, [fn=std::move(fn)](auto) {
         return fn();
     });
 }
 
 template<typename T>
-Future<T> Future<T>::on_error(std::function<void()> fn) const {
+Future<T> Future<T>::on_error(FutureContinuation<void()> fn) const {
     return FutureBase::on_error(*this, [fn=std::move(fn)](auto f) {
         fn();
         return f;
@@ -233,33 +387,79 @@ Future<T> Future<T>::on_error(std::function<void()> fn) const {
 }
 
 template<typename T>
-Future<T> Future<T>::finally(std::function<void()> fn) const {
-    return FutureBase::finally<T>(*this, [fn=std::move(fn)](auto) {
+Future<T> Future<T>::finally(FutureContinuation<void()> fn) const {
+    return FutureBase::finally(*this, [fn=std::move(fn)](auto) {
         fn();
     });
 }
 
 template<typename T>
-Future<T> Future<T>::with_timeout(unsigned long timeout) const {
-    return FutureBase::with_timeout<T>(*this, timeout);
+Future<T> Future<T>::with_timeout(unsigned long timeout, unsigned long slack) const {
+    return FutureBase::with_deadline<T>(*this, deadline_after(timeout), slack);
+}
+
+template<typename T>
+Future<T> Future<T>::with_deadline(unsigned long deadline, unsigned long slack) const {
+    return FutureBase::with_deadline<T>(*this, deadline, slack);
+}
+
+template<typename T>
+Future<T> Future<T>::cancel_at(unsigned long deadline, unsigned long slack) const {
+    set_deadline(deadline, slack);
+    return *this;
 }
 
 template<typename T>
-Future<T> Future<T>::finally(
-    std::function<void(const Future &)> fn)
-const {
+Future<T> Future<T>::cancel_after(unsigned long timeout, unsigned long slack) const {
+    return cancel_at(deadline_after(timeout), slack);
+}
+
+template<typename T>
+Future<T> Future<T>::with_cancellation(const CancellationToken &token) const {
+    return FutureBase::with_cancellation<T>(*this, token);
+}
+
+template<typename T>
+template<typename R>
+Future<R> Future<T>::then_on(Executor &executor, FutureContinuation<Future<R>(const Future &)> fn) const {
+    return via(executor).template then<R>(std::move(fn));
+}
+
+template<typename T>
+template<typename R>
+Future<R> Future<T>::then_on(Executor &executor, FutureContinuation<R(const Future &)> fn) const {
+    return via(executor).template then<R>(std::move(fn));
+}
+
+template<typename T>
+Future<T> Future<T>::via(Executor &executor) const {
+    return FutureBase::via<T>(*this, executor);
+}
+
+template<typename T>
+Future<T> Future<T>::finally(FutureContinuation<void(const Future &)> fn) const {
     return FutureBase::finally(*this, std::move(fn));
 }
 
 template<typename T>
 Future<T> Future<T>::successful(T value) {
     auto promise = Promise<T>::create();
-    promise->set_success(value);
+    promise->set_success(std::move(value));
     return promise;
 }
 
 template<typename R>
-Future<R> Future<void>::then(std::function<Future<R>(const Future &)> fn) { return FutureBase::then<void, R>(*this, std::move(fn)); }
+Future<R> Future<void>::then(FutureContinuation<Future<R>(const Future &)> fn) { return FutureBase::then<void, R>(*this, std::move(fn)); }
 
 template<typename R>
-Future<R> Future<void>::then(std::function<R(const Future &)> fn) { return FutureBase::then<void, R>(*this, std::move(fn)); }
+Future<R> Future<void>::then(FutureContinuation<R(const Future &)> fn) { return FutureBase::then<void, R>(*this, std::move(fn)); }
+
+template<typename R>
+Future<R> Future<void>::then_on(Executor &executor, FutureContinuation<Future<R>(const Future &)> fn) const {
+    return via(executor).then<R>(std::move(fn));
+}
+
+template<typename R>
+Future<R> Future<void>::then_on(Executor &executor, FutureContinuation<R(const Future &)> fn) const {
+    return via(executor).then<R>(std::move(fn));
+}
@@ -0,0 +1,81 @@
+#include "interval_stream.h"
+#include "promise.h"
+
+IntervalStream::IntervalStream(unsigned long period_ms, unsigned long slack_ms) : _state(std::make_shared<State>()) {
+    _interval = SystemTimer::set_interval(period_ms, [state = _state] { _on_tick(state); }, slack_ms);
+    if (!_interval) _state->cancelled = true;
+}
+
+IntervalStream::~IntervalStream() {
+    cancel();
+}
+
+Future<uint32_t> IntervalStream::next() {
+    // Allocated and released outside of critical section
+    auto promise = Promise<uint32_t>::create();
+    std::shared_ptr<Promise<uint32_t>> spare;
+
+    portENTER_CRITICAL(&_state->spinlock);
+
+    if (_state->cancelled) {
+        portEXIT_CRITICAL(&_state->spinlock);
+        return Future<uint32_t>::errored();
+    }
+
+    if (_state->delivered != _state->ticks) {
+        const auto tick = _state->delivered = _state->ticks;
+        portEXIT_CRITICAL(&_state->spinlock);
+
+        return Future<uint32_t>::successful(tick);
+    }
+
+    // Pending waiter is shared, one cancelled by its consumer is replaced
+    if (_state->waiting && !_state->waiting->finished()) {
+        spare = std::move(promise);
+        promise = _state->waiting;
+    } else {
+        spare = std::move(_state->waiting);
+        _state->waiting = promise;
+    }
+
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    return Future {promise};
+}
+
+void IntervalStream::cancel() {
+    _interval.cancel();
+
+    portENTER_CRITICAL(&_state->spinlock);
+    _state->cancelled = true;
+    auto waiting = std::move(_state->waiting);
+    portEXIT_CRITICAL(&_state->spinlock);
+
+    if (waiting) waiting->set_error();
+}
+
+void IntervalStream::_on_tick(const std::shared_ptr<State> &state) {
+    portENTER_CRITICAL(&state->spinlock);
+    const auto tick = ++state->ticks;
+    portEXIT_CRITICAL(&state->spinlock);
+
+    while (true) {
+        portENTER_CRITICAL(&state->spinlock);
+
+        auto waiting = std::move(state->waiting);
+        const auto delivered = state->delivered;
+        if (waiting) state->delivered = tick;
+
+        portEXIT_CRITICAL(&state->spinlock);
+
+        if (!waiting) return;
+
+        waiting->set_success(tick);
+        if (waiting->success()) return;
+
+        // Waiter was cancelled meanwhile, tick is kept for the next one
+        portENTER_CRITICAL(&state->spinlock);
+        if (state->delivered == tick) state->delivered = delivered;
+        portEXIT_CRITICAL(&state->spinlock);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+
+#include "future.h"
+#include "system_timer.h"
+
+/**
+ * Stream of SystemTimer interval ticks.
+ *
+ * Works like a ticker: ticks which happened while nobody waited collapse into one, so slow consumer never falls behind.
+ * Future returned by ::next() resolves with number of the latest tick or fails when stream is cancelled.
+ */
+class IntervalStream {
+    struct State {
+        portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+        std::shared_ptr<Promise<uint32_t>> waiting;
+        uint32_t ticks = 0;
+        uint32_t delivered = 0;
+        bool cancelled = false;
+    };
+
+    std::shared_ptr<State> _state;
+    IntervalHandle _interval;
+
+public:
+    explicit IntervalStream(unsigned long period_ms, unsigned long slack_ms = 0);
+    ~IntervalStream();
+
+    IntervalStream(const IntervalStream &) = delete;
+    IntervalStream &operator=(IntervalStream const &) = delete;
+
+    Future<uint32_t> next();
+    void cancel();
+
+    [[nodiscard]] bool active() const { return (bool) _interval; }
+
+private:
+    static void _on_tick(const std::shared_ptr<State> &state);
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "promise.h"
+
+/**
+ * Fused continuation chains: `future | then(f) | on_error(g) | finally(h)`.
+ *
+ * Stages are plain lambdas with deduced types, collected at compile time and run one after another from a single
+ * on_finished callback, so the whole chain costs one Promise instead of one Promise and closure per step.
+ * A stage returning Future suspends the chain until that future is finished.
+ * with_timeout() wraps everything before it with Future::with_timeout() and starts a new chain.
+ *
+ * Chain starts when converted to Future, or when the chain expression is destroyed unused.
+ * Cancelled chain skips remaining stages. Chain without on_error() stages inherits deadline of the source
+ * and skips remaining stages once it expires.
+ */
+namespace pipeline {
+    template<typename T> struct FutureTraits : std::false_type {};
+    template<typename T> struct FutureTraits<Future<T>> : std::true_type { typedef T type; };
+
+    // Continues on success with the value (or nothing for void). May return a value, void or Future
+    template<typename F> struct Then { F fn; };
+
+    // Called on error without arguments. Returning void only observes the error;
+    // returning value or Future recovers the chain
+    template<typename F> struct OnError { F fn; };
+
+    // Called on both outcomes without arguments, outcome passes through
+    template<typename F> struct Finally { F fn; };
+
+    struct Timeout {
+        unsigned long timeout;
+        unsigned long slack;
+    };
+
+    template<typename F> Then<std::decay_t<F>> then(F &&fn) { return {std::forward<F>(fn)}; }
+    template<typename F> OnError<std::decay_t<F>> on_error(F &&fn) { return {std::forward<F>(fn)}; }
+    template<typename F> Finally<std::decay_t<F>> finally(F &&fn) { return {std::forward<F>(fn)}; }
+    inline Timeout with_timeout(unsigned long timeout, unsigned long slack = 0) { return {timeout, slack}; }
+
+    template<typename T> struct IsThen : std::false_type {};
+    template<typename F> struct IsThen<Then<F>> : std::true_type {};
+
+    template<typename T> struct IsOnError : std::false_type {};
+    template<typename F> struct IsOnError<OnError<F>> : std::true_type {};
+
+    template<typename T> struct IsFinally : std::false_type {};
+    template<typename F> struct IsFinally<Finally<F>> : std::true_type {};
+
+    template<typename T> struct IsStage : std::bool_constant<IsThen<T>::value || IsOnError<T>::value || IsFinally<T>::value> {};
+
+    template<typename F, typename In> struct ThenResult { typedef std::invoke_result_t<F &, In &&> type; };
+    template<typename F> struct ThenResult<F, void> { typedef std::invoke_result_t<F &> type; };
+
+    template<typename Stage, typename In> struct StageTraits;
+
+    template<typename F, typename In>
+    struct StageTraits<Then<F>, In> {
+        typedef typename ThenResult<F, In>::type Ret;
+
+        static constexpr bool ASYNC = FutureTraits<Ret>::value;
+        typedef typename std::conditional_t<ASYNC, FutureTraits<Ret>, std::enable_if<true, Ret>>::type Out;
+    };
+
+    template<typename F, typename In>
+    struct StageTraits<OnError<F>, In> {
+        typedef std::invoke_result_t<F &> Ret;
+
+        static constexpr bool ASYNC = FutureTraits<Ret>::value;
+        typedef In Out;
+
+        static_assert(std::is_void_v<Ret> || (ASYNC && std::is_same_v<Ret, Future<In>>) || std::is_convertible_v<Ret, In>,
+            "pipeline::on_error(): handler must return void, value of the chain or Future of it");
+    };
+
+    template<typename F, typename In>
+    struct StageTraits<Finally<F>, In> {
+        static constexpr bool ASYNC = false;
+        typedef In Out;
+    };
+
+    template<typename In, typename... Stages> struct ChainResult { typedef In type; };
+
+    template<typename In, typename Stage, typename... Rest>
+    struct ChainResult<In, Stage, Rest...> {
+        typedef typename ChainResult<typename StageTraits<Stage, In>::Out, Rest...>::type type;
+    };
+
+    template<typename T, typename... Stages>
+    class Chain {
+    public:
+        typedef typename ChainResult<T, Stages...>::type ResultType;
+
+    private:
+        typedef std::tuple<Stages...> StageList;
+
+        Future<T> _source;
+        StageList _stages;
+        bool _consumed = false;
+
+    public:
+        Chain(Future<T> source, StageList &&stages) : _source(std::move(source)), _stages(std::move(stages)) {}
+
+        Chain(Chain &&other) noexcept : _source(other._source), _stages(std::move(other._stages)) { other._consumed = true; }
+
+        Chain(const Chain &) = delete;
+        Chain &operator=(const Chain &) = delete;
+
+        ~Chain() { if (!_consumed) (void) future(); }
+
+        Future<ResultType> future();
+        operator Future<ResultType>() { return future(); } // NOLINT(*-explicit-constructor)
+
+        template<typename Stage>
+        Chain<T, Stages..., Stage> append(Stage &&stage) {
+            _consumed = true;
+            return {_source, std::tuple_cat(std::move(_stages), std::make_tuple(std::forward<Stage>(stage)))};
+        }
+
+    private:
+        typedef std::shared_ptr<Promise<ResultType>> ResultPromise;
+
+        template<size_t I, typename In>
+        static void _run(ResultPromise &&result, StageList &&stages, bool success, std::optional<FutureValue<In>> &&value);
+
+        template<size_t I, typename U>
+        static void _resume_on(Future<U> future, ResultPromise &&result, StageList &&stages);
+    };
+
+    template<typename T, typename... Stages>
+    Future<typename Chain<T, Stages...>::ResultType> Chain<T, Stages...>::future() {
+        _consumed = true;
+
+        auto result = Promise<ResultType>::create();
+        // Error handler may recover from expiration, so it must not be bounded by the deadline
+        if constexpr (!(IsOnError<Stages>::value || ...)) result->inherit_deadline(_source.deadline());
+        _resume_on<0>(_source, ResultPromise {result}, std::move(_stages));
+
+        return result;
+    }
+
+    template<typename T, typename... Stages>
+    template<size_t I, typename U>
+    void Chain<T, Stages...>::_resume_on(Future<U> future, ResultPromise &&result, StageList &&stages) {
+        // Cancelling the chain cancels the future it is waiting for. Future of a stage may be shared,
+        // so it gets neither the deadline nor cancellation on expiration, the chain expires alone
+        result->set_cancel_handler([raw_result = result.get(), upstream = future.weak_promise()] {
+            if (!raw_result->expired()) FutureBase::cancel_weak(upstream);
+        });
+        // Source bounded by the same deadline already enforces it
+        if (future.deadline() != result->deadline()) PromiseBase::enforce_deadline(result);
+
+        future.on_finished([future, result = std::move(result), stages = std::move(stages)](bool success) mutable {
+            if (result->finished() || (result->expired() && result->cancel())) return;
+
+            std::optional<FutureValue<U>> value;
+            if (success) {
+                if constexpr (std::is_void_v<U>) value.emplace();
+                else value.emplace(future.consume());
+            }
+
+            _run<I, U>(std::move(result), std::move(stages), success, std::move(value));
+        });
+    }
+
+    template<typename T, typename... Stages>
+    template<size_t I, typename In>
+    void Chain<T, Stages...>::_run(ResultPromise &&result, StageList &&stages, bool success, std::optional<FutureValue<In>> &&value) {
+        if constexpr (I == sizeof...(Stages)) {
+            if (!success) {
+                result->set_error();
+            } else if constexpr (std::is_void_v<In>) {
+                result->set_success();
+            } else {
+                result->set_success(std::move(*value));
+            }
+        } else {
+            typedef std::tuple_element_t<I, StageList> Stage;
+            typedef StageTraits<Stage, In> Traits;
+            typedef typename Traits::Out Out;
+
+            auto &fn = std::get<I>(stages).fn;
+
+            if constexpr (IsThen<Stage>::value) {
+                if (!success) return _run<I + 1, Out>(std::move(result), std::move(stages), false, std::nullopt);
+
+                auto call = [&] {
+                    if constexpr (std::is_void_v<In>) return fn();
+                    else return fn(std::move(*value));
+                };
+
+                if constexpr (Traits::ASYNC) {
+                    _resume_on<I + 1>(call(), std::move(result), std::move(stages));
+                } else if constexpr (std::is_void_v<Out>) {
+                    call();
+                    _run<I + 1, Out>(std::move(result), std::move(stages), true, std::monostate {});
+                } else {
+                    _run<I + 1, Out>(std::move(result), std::move(stages), true, call());
+                }
+            } else if constexpr (IsOnError<Stage>::value) {
+                if (success) return _run<I + 1, Out>(std::move(result), std::move(stages), true, std::move(value));
+
+                if constexpr (Traits::ASYNC) {
+                    _resume_on<I + 1>(fn(), std::move(result), std::move(stages));
+                } else if constexpr (std::is_void_v<typename Traits::Ret>) {
+                    fn();
+                    _run<I + 1, Out>(std::move(result), std::move(stages), false, std::nullopt);
+                } else {
+                    _run<I + 1, Out>(std::move(result), std::move(stages), true, FutureValue<Out>(fn()));
+                }
+            } else {
+                fn();
+                _run<I + 1, Out>(std::move(result), std::move(stages), success, std::move(value));
+            }
+        }
+    }
+}
+
+template<typename T, typename Stage, typename = std::enable_if_t<pipeline::IsStage<Stage>::value>>
+pipeline::Chain<T, Stage> operator|(const Future<T> &future, Stage stage) {
+    return {future, std::make_tuple(std::move(stage))};
+}
+
+template<typename T, typename... Stages, typename Stage, typename = std::enable_if_t<pipeline::IsStage<Stage>::value>>
+pipeline::Chain<T, Stages..., Stage> operator|(pipeline::Chain<T, Stages...> &&chain, Stage stage) {
+    return chain.append(std::move(stage));
+}
+
+template<typename T>
+Future<T> operator|(const Future<T> &future, pipeline::Timeout timeout) {
+    return future.with_timeout(timeout.timeout, timeout.slack);
+}
+
+template<typename T, typename... Stages>
+Future<typename pipeline::Chain<T, Stages...>::ResultType> operator|(pipeline::Chain<T, Stages...> &&chain, pipeline::Timeout timeout) {
+    return chain.future().with_timeout(timeout.timeout, timeout.slack);
+}
@@ -1,82 +1,341 @@
 #include "promise.h"
 #include <Arduino.h>
 
+PromiseBase::~PromiseBase() {
+#if PROMISE_INSTRUMENTATION
+    PromiseTracker::untrack(_trace);
+#endif
+
+    _release_deadline_timer();
+
+    // Pending nodes of never resolved promise
+    auto *node = (Node *) (_state.load(std::memory_order_acquire) & ~STATE_FLAGS_MASK);
+    while (node != nullptr) {
+        auto *next = node->next;
+        if (node != &_inline_callback) _free_node(node);
+        node = next;
+    }
+
+    node = _resolved_nodes;
+    while (node != nullptr) {
+        auto *next = node->next;
+        _free_node(node);
+        node = next;
+    }
+}
+
 void PromiseBase::set_success() {
-    portENTER_CRITICAL(&spinlock);
+    if (_claim("resolve")) _resolve(STATE_SUCCESS);
+}
 
-    if (_finished) {
-        D_PRINTF("Promise (%p): Trying to resolve already resolved promise\r\n", this);
-        portEXIT_CRITICAL(&spinlock);
-        return;
+void PromiseBase::set_error() {
+    if (_claim("reject")) _resolve(STATE_ERROR);
+}
+
+bool PromiseBase::_claim(const char *action) {
+    auto state = _state.load(std::memory_order_acquire);
+    do {
+        if (state & (STATE_CLAIMED | STATE_OUTCOME_MASK)) {
+            // Producer of cancelled promise may not know about cancellation yet
+            if ((state & STATE_OUTCOME_MASK) != STATE_CANCELLED) {
+                D_PRINTF("Promise (%p): Trying to %s already resolved promise\r\n", this, action);
+            }
+
+            return false;
+        }
+    } while (!_state.compare_exchange_weak(state, state | STATE_CLAIMED, std::memory_order_acquire));
+
+    return true;
+}
+
+void PromiseBase::_resolve(uintptr_t outcome) {
+    // Only the claimer gets here, so the swap can't lose a concurrent resolution, only take a concurrent push
+    const auto state = _state.exchange(STATE_CLAIMED | outcome, std::memory_order_acq_rel);
+
+#if PROMISE_INSTRUMENTATION
+    PromiseTracker::resolved(_trace);
+#endif
+
+    // Timer API isn't available in ISR, there the timer fires later and finds promise already resolved
+    if (!xPortInIsrContext()) _release_deadline_timer();
+
+    _release_cancel_handler(outcome == STATE_CANCELLED);
+    _on_promise_finished((Node *) (state & ~STATE_FLAGS_MASK));
+}
+
+bool PromiseBase::_push_node(Node *node) const {
+    auto state = _state.load(std::memory_order_acquire);
+    do {
+        if (state & STATE_OUTCOME_MASK) return false;
+        node->next = (Node *) (state & ~STATE_FLAGS_MASK);
+    } while (!_state.compare_exchange_weak(state, (uintptr_t) node | (state & STATE_FLAGS_MASK),
+        std::memory_order_release, std::memory_order_acquire));
+
+    return true;
+}
+
+bool PromiseBase::_pop_node(Node *node) const {
+    // Pending nodes are never changed nor freed by others, so node->next is stable and there is no ABA
+    auto state = _state.load(std::memory_order_acquire);
+    do {
+        if ((state & STATE_OUTCOME_MASK) || (Node *) (state & ~STATE_FLAGS_MASK) != node) return false;
+    } while (!_state.compare_exchange_weak(state, (uintptr_t) node->next | (state & STATE_FLAGS_MASK),
+        std::memory_order_acquire, std::memory_order_acquire));
+
+    return true;
+}
+
+void PromiseBase::_free_node(Node *node) {
+    if (node->waiter) {
+        auto *waiter = static_cast<WaiterNode *>(node);
+        vSemaphoreDelete(waiter->semaphore);
+        delete waiter;
+    } else {
+        delete static_cast<CallbackNode *>(node);
+    }
+}
+
+void PromiseBase::_on_promise_finished(Node *nodes) {
+    VERBOSE(D_PRINTF("Promise (%p): Done\r\n", this));
+
+    // Nodes are pushed to the head, restore registration order
+    Node *ordered = nullptr;
+    while (nodes != nullptr) {
+        auto *next = nodes->next;
+        nodes->next = ordered;
+        ordered = nodes;
+        nodes = next;
     }
 
-    _finished = true;
-    _success = true;
+    const bool success = this->success();
+
+    // Resolution caused by urgent continuation keeps the whole chain urgent
+    const auto priority = std::max(_priority, Dispatcher::current_priority());
+
+    // Resolution runs on the producer's task, and possibly in ISR, so nothing is freed here
+    Node *retained = nullptr;
+    while (ordered != nullptr) {
+        auto *node = ordered;
+        ordered = node->next;
+
+        bool retain = node != &_inline_callback;
+        if (node->waiter) {
+            auto *waiter = static_cast<WaiterNode *>(node);
+            if (xPortInIsrContext()) {
+                xSemaphoreGiveFromISR(waiter->semaphore, nullptr);
+            } else {
+                xSemaphoreGive(waiter->semaphore);
+            }
+
+            // Waiter still around frees the node itself
+            retain = waiter->state.exchange(WAITER_SIGNALLED, std::memory_order_acq_rel) == WAITER_ABANDONED;
+        } else {
+            auto *callback_node = static_cast<CallbackNode *>(node);
+            _dispatch_callback(std::move(callback_node->callback), success, priority, callback_node->executor, false);
+        }
 
-    portEXIT_CRITICAL(&spinlock);
-    _on_promise_finished();
+        if (retain) {
+            node->next = retained;
+            retained = node;
+        }
+    }
+
+    _resolved_nodes = retained;
 }
 
-void PromiseBase::set_error() {
-    portENTER_CRITICAL(&spinlock);
+void PromiseBase::_dispatch_callback(FutureFinishedCb &&callback, bool success, Dispatcher::Priority priority, Executor *executor, bool allow_inline) const {
+    if (executor == nullptr) executor = _executor;
+
+    if (executor != nullptr) {
+        if (!executor->execute([success, callback = std::move(callback)] { callback(success); }, priority)) {
+            D_PRINTF("Promise (%p): Executor dropped continuation\r\n", this);
+        }
 
-    if (_finished) {
-        D_PRINTF("Promise (%p): Trying to reject already resolved promise\r\n", this);
-        portEXIT_CRITICAL(&spinlock);
         return;
     }
 
-    _finished = true;
-    _success = false;
+    Dispatcher::DispatchFn fn = [success, callback = std::move(callback)] {
+        callback(success);
+    };
 
-    portEXIT_CRITICAL(&spinlock);
-    _on_promise_finished();
+    // Only callbacks attached to already finished promise run in place: they are on the attaching code's stack,
+    // not inside the resolver, which may hold a lock or expect deferred continuations. Use InlineExecutor otherwise
+    if (allow_inline) {
+        Dispatcher::dispatch_inline(std::move(fn), priority, _worker);
+    } else if (_worker != Dispatcher::NO_WORKER) {
+        Dispatcher::dispatch_to(_worker, std::move(fn), priority);
+    } else {
+        Dispatcher::dispatch(std::move(fn), priority);
+    }
 }
 
-void PromiseBase::_on_promise_finished() {
-    VERBOSE(D_PRINTF("Promise (%p): Done\r\n", this));
-    if (_on_finished_callbacks.empty()) return;
+bool PromiseBase::wait(unsigned long timeout) const {
+    if (timeout == 0) return _wait(portMAX_DELAY);
 
-    for (auto &callback: _on_finished_callbacks) {
-        Dispatcher::dispatch([=] {
-            callback(_success);
-        });
-    }
+    return wait_until(millis() + timeout);
+}
+
+bool PromiseBase::wait_until(unsigned long deadline) const {
+    const auto left = (long) (deadline - millis());
+    if (left <= 0) return finished();
 
-    _on_finished_callbacks.clear();
+    // Extra tick covers partially elapsed current tick
+    return _wait(std::min<TickType_t>(pdMS_TO_TICKS(left) + 1, portMAX_DELAY - 1));
 }
 
+bool PromiseBase::_wait(TickType_t ticks) const {
+    if (finished()) return true;
 
-bool PromiseBase::wait(unsigned long timeout, unsigned long delay_interval) const {
-    if (_finished) return true;
+    VERBOSE(D_PRINTF("Promise (%p): Waiting, ticks: %lu\r\n", this, (unsigned long) ticks));
+    const auto start = millis();
 
-    VERBOSE(D_PRINTF("Promise (%p): Waiting, timeout: %lu\r\n", this, timeout));
+    auto *waiter = new WaiterNode;
+    waiter->waiter = true;
+    waiter->semaphore = xSemaphoreCreateBinaryStatic(&waiter->semaphore_buffer);
 
-    auto start = millis();
-    while (!_finished && (timeout == 0 || millis() - start < timeout)) {
-        delay(delay_interval);
+    if (!_push_node(waiter)) {
+        _free_node(waiter);
+        return true;
+    }
+
+    // Timed out waiter unlinks its node, so polling of long pending promise doesn't pile nodes up.
+    // Node buried under newer ones can't be unlinked from lock-free list and is left to the resolution
+    if (xSemaphoreTake(waiter->semaphore, ticks) != pdTRUE && _pop_node(waiter)) {
+        _free_node(waiter);
+    } else if (waiter->state.exchange(WAITER_ABANDONED, std::memory_order_acq_rel) == WAITER_SIGNALLED) {
+        // Resolution already done with the node, otherwise it will take care of it
+        _free_node(waiter);
     }
 
     VERBOSE(D_PRINTF("Promise (%p): Finished with status: %s. Elapsed: %lu\r\n", this, finished() ? "Done" : "Timeout", millis() - start));
 
-    return _finished;
+    return finished();
 }
 
-void PromiseBase::on_finished(FutureFinishedCb callback) {
-    portENTER_CRITICAL(&spinlock);
-    if (_finished) {
-        portEXIT_CRITICAL(&spinlock);
+void PromiseBase::on_finished(FutureFinishedCb callback, Executor *executor) {
+#if PROMISE_INSTRUMENTATION
+    PromiseTracker::callback_added(_trace);
+#endif
 
-        VERBOSE(D_PRINTF("Promise (%p): Set on_finished callback for already finished promise\r\n", this));
-        Dispatcher::dispatch([=, callback=std::move(callback)] {
-            callback(_success);
-        });
-    } else {
-        _on_finished_callbacks.push_back(std::move(callback));
-        portEXIT_CRITICAL(&spinlock);
+    if (!finished()) {
+        const bool use_inline = !_inline_callback_used.exchange(true, std::memory_order_relaxed);
+        auto *node = use_inline ? &_inline_callback : new CallbackNode;
+        node->callback = std::move(callback);
+        node->executor = executor;
+
+        if (_push_node(node)) {
+            if (!use_inline) PromisePool::count_callback_spill();
+
+            VERBOSE(D_PRINTF("Promise (%p): Add on_finished callback\r\n", this));
+            return;
+        }
+
+        // Resolved meanwhile
+        callback = std::move(node->callback);
+        if (!use_inline) delete node;
+    }
+
+    VERBOSE(D_PRINTF("Promise (%p): Set on_finished callback for already finished promise\r\n", this));
+    _dispatch_callback(std::move(callback), success(), std::max(_priority, Dispatcher::current_priority()), executor, true);
+}
+
+void PromiseBase::set_cancel_handler(PromiseCancelHandler handler) {
+    auto state = _cancel_handler_state.load(std::memory_order_acquire);
+    do {
+        if (state & CANCEL_HANDLER_SEALED) return;
+    } while (!_cancel_handler_state.compare_exchange_weak(state, state | CANCEL_HANDLER_BUSY, std::memory_order_acquire));
+
+    _cancel_handler = std::move(handler);
+
+    uint8_t expected = state | CANCEL_HANDLER_BUSY;
+    if (_cancel_handler_state.compare_exchange_strong(expected, CANCEL_HANDLER_SET, std::memory_order_acq_rel)) return;
+
+    // Promise was resolved while handler was being written, resolution left the handler to us
+    if (cancelled()) _cancel_handler();
+    _cancel_handler = nullptr;
+}
+
+void PromiseBase::_release_cancel_handler(bool run) {
+    const auto state = _cancel_handler_state.fetch_or(CANCEL_HANDLER_SEALED, std::memory_order_acq_rel);
+    if ((state & CANCEL_HANDLER_BUSY) || !(state & CANCEL_HANDLER_SET)) return;
+
+    // Handler may hold references to producer's resources, release them together with the promise
+    auto handler = std::move(_cancel_handler);
+    if (run) handler();
+}
+
+bool PromiseBase::cancel() {
+    auto state = _state.load(std::memory_order_acquire);
+    do {
+        if (state & (STATE_CLAIMED | STATE_OUTCOME_MASK)) return false;
+    } while (!_state.compare_exchange_weak(state, state | STATE_CLAIMED, std::memory_order_acquire));
+
+    VERBOSE(D_PRINTF("Promise (%p): Cancelled\r\n", this));
+
+    _resolve(STATE_CANCELLED);
+    return true;
+}
+
+bool PromiseBase::expired() const {
+    const auto deadline = _deadline.load(std::memory_order_relaxed);
+    return deadline != 0 && (int32_t) ((uint32_t) millis() - deadline) >= 0;
+}
+
+void PromiseBase::inherit_deadline(unsigned long deadline) {
+    _tighten_deadline(deadline);
+}
+
+void PromiseBase::set_deadline(const std::shared_ptr<PromiseBase> &promise, unsigned long deadline, unsigned long slack) {
+    if (promise->finished() || !promise->_tighten_deadline(deadline)) return;
+
+    _arm_deadline_timer(promise, deadline, slack);
+}
 
-        VERBOSE(D_PRINTF("Promise (%p): Add on_finished callback\r\n", this));
+void PromiseBase::enforce_deadline(const std::shared_ptr<PromiseBase> &promise, unsigned long slack) {
+    const auto deadline = promise->_deadline.load(std::memory_order_relaxed);
+    if (deadline == 0 || promise->finished() || promise->_deadline_timer.load(std::memory_order_acquire) != 0) return;
+
+    _arm_deadline_timer(promise, deadline, slack);
+}
+
+void PromiseBase::_arm_deadline_timer(const std::shared_ptr<PromiseBase> &promise, uint32_t deadline, unsigned long slack) {
+    const auto left = (int32_t) ((uint32_t) deadline - (uint32_t) millis());
+    if (left <= 0) {
+        promise->cancel();
+        return;
     }
+
+    // Timer doesn't own the promise, so abandoned promise is freed without waiting for its deadline
+    auto timer = SystemTimer::set_timeout(left, [weak_promise = std::weak_ptr<PromiseBase>(promise)] {
+        auto promise = weak_promise.lock();
+        if (promise && promise->cancel()) VERBOSE(D_PRINTF("Promise (%p): Deadline expired\r\n", promise.get()));
+    }, slack);
+
+    // Work that hasn't even started isn't cancelled for lack of a timer: deadline is still visible to expired()
+    if (!timer) {
+        D_PRINTF("Promise (%p): Unable to set deadline timer. Deadline isn't enforced\r\n", promise.get());
+        return;
+    }
+
+    TimerHandle(promise->_deadline_timer.exchange(timer.id(), std::memory_order_acq_rel)).cancel();
+
+    // Resolution could happen before the timer was stored
+    if (promise->finished()) promise->_release_deadline_timer();
+}
+
+bool PromiseBase::_tighten_deadline(uint32_t deadline) {
+    if (deadline == 0) return false;
+
+    auto current = _deadline.load(std::memory_order_relaxed);
+    do {
+        if (current != 0 && (int32_t) (deadline - current) >= 0) return false;
+    } while (!_deadline.compare_exchange_weak(current, deadline, std::memory_order_relaxed));
+
+    return true;
+}
+
+void PromiseBase::_release_deadline_timer() {
+    TimerHandle(_deadline_timer.exchange(0, std::memory_order_acq_rel)).cancel();
 }
 
 Future<void> PromiseBase::all(const std::vector<Future<void>> &collection) {
@@ -99,10 +358,11 @@ Future<void> PromiseBase::all(const std::vector<Future<void>> &collection) {
     }
 
     auto result_promise = Promise<void>::create();
-    auto count_left = std::make_shared<std::size_t>(collection.size());
+    // Callbacks may run on different workers at the same time
+    auto count_left = std::make_shared<std::atomic<std::size_t>>(collection.size());
 
     auto finished_cb = [count_left = std::move(count_left), result_promise](bool success) {
-        VERBOSE(D_PRINTF("Promise::all(): Promise finished, left: %i\r\n", *count_left - 1));
+        VERBOSE(D_PRINTF("Promise::all(): Promise finished, left: %i\r\n", count_left->load() - 1));
         if (result_promise->finished()) return;
 
         if (!success) {
@@ -139,7 +399,7 @@ Future<void> PromiseBase::any(const std::vector<Future<void>> &collection) {
         }
     }
 
-    auto result_promise = std::make_shared<Promise<void>>();
+    auto result_promise = Promise<void>::create();
     auto finished_cb = [result_promise](bool success) {
         if (result_promise->finished()) return;
 
@@ -2,167 +2,506 @@
 
 #include <Arduino.h>
 
+#include <atomic>
 #include <memory>
+#include <optional>
+#include <tuple>
+#include <variant>
 #include <vector>
 
 #include "dispatcher.h"
+#include "executor.h"
 #include "future.h"
+#include "promise_pool.h"
+#include "promise_tracker.h"
 #include "../debug.h"
 
+#ifndef PROMISE_CANCEL_HANDLER_CAPACITY
+#define PROMISE_CANCEL_HANDLER_CAPACITY                     (4 * sizeof(void *))
+#endif
+
 class FutureBase;
 class PromiseBase;
 template<typename T> class Future;
 template<typename T> class Promise;
 
+typedef InplaceFunction<void(), PROMISE_CANCEL_HANDLER_CAPACITY> PromiseCancelHandler;
 
 class PromiseBase {
-    volatile bool _finished = false;
-    volatile bool _success = false;
+    // Continuation or task blocked in wait(), registered while promise is pending
+    struct alignas(8) Node {
+        Node *next = nullptr;
+        bool waiter = false;
+    };
+
+    struct CallbackNode : Node {
+        FutureFinishedCb callback;
+        Executor *executor = nullptr;
+    };
+
+    enum : uint8_t {
+        WAITER_WAITING = 0,
+        WAITER_SIGNALLED = 1,
+        // Waiter timed out while node was buried under newer ones, node is freed together with the promise
+        WAITER_ABANDONED = 2,
+    };
+
+    struct WaiterNode : Node {
+        StaticSemaphore_t semaphore_buffer {};
+        SemaphoreHandle_t semaphore = nullptr;
+        std::atomic<uint8_t> state {WAITER_WAITING};
+    };
+
+protected:
+    // Whole promise state in a single word: outcome in the low bits, head of the node list in the rest.
+    // Resolution swaps the word at once, so it takes the list and seals it against new nodes in one step
+    enum : uintptr_t {
+        STATE_PENDING = 0,
+        STATE_SUCCESS = 1,
+        STATE_ERROR = 2,
+        STATE_CANCELLED = 3,
+        STATE_OUTCOME_MASK = 3,
+
+        // Resolution is in progress, e.g. result is being written
+        STATE_CLAIMED = 4,
+        STATE_FLAGS_MASK = 7,
+    };
+
+    static_assert(alignof(Node) > STATE_FLAGS_MASK, "PromiseBase: Node pointer must leave room for state flags");
+
+private:
+    enum : uint8_t {
+        CANCEL_HANDLER_SET = 1,
+        CANCEL_HANDLER_BUSY = 2,
+        CANCEL_HANDLER_SEALED = 4,
+    };
+
+    // Waiters push nodes from const wait()
+    mutable std::atomic<uintptr_t> _state {STATE_PENDING};
+
+    Dispatcher::Priority _priority = Dispatcher::Priority::NORMAL;
+    uint8_t _worker = Dispatcher::NO_WORKER;
+    Executor *_executor = nullptr;
+
+    // Almost every promise has exactly one continuation, so only the rest are allocated
+    std::atomic<bool> _inline_callback_used {false};
+    CallbackNode _inline_callback;
+
+    // Nodes taken by resolution. They may be still referenced by abandoned waiters, so they live as long as the promise
+    Node *_resolved_nodes = nullptr;
+
+    std::atomic<uint8_t> _cancel_handler_state {0};
+    PromiseCancelHandler _cancel_handler;
 
-    std::vector<FutureFinishedCb> _on_finished_callbacks;
+    // Absolute millis() time, 0 if none. Only the tightest deadline of a promise has a timer
+    std::atomic<uint32_t> _deadline {0};
+    std::atomic<uint32_t> _deadline_timer {0};
 
 #ifdef DEBUG
     int _initial_core_id = xPortGetCoreID();
 #endif
 
+#if PROMISE_INSTRUMENTATION
+    PromiseTrace _trace;
+#endif
+
 public:
     PromiseBase(const PromiseBase &) = delete;
     PromiseBase &operator=(PromiseBase const &) = delete;
-    virtual ~PromiseBase() = default;
+    virtual ~PromiseBase();
 
     [[nodiscard]] virtual bool has_result() const { return false; }
 
-    [[nodiscard]] bool finished() const { return _finished; }
-    [[nodiscard]] bool success() const { return _success; }
+    [[nodiscard]] bool finished() const { return _outcome() != STATE_PENDING; }
+    [[nodiscard]] bool success() const { return _outcome() == STATE_SUCCESS; }
+    [[nodiscard]] bool cancelled() const { return _outcome() == STATE_CANCELLED; }
+
+    // Priority of continuations dispatched on resolution. Use URGENT for promises resolved by radio events
+    [[nodiscard]] Dispatcher::Priority priority() const { return _priority; }
+    void set_priority(Dispatcher::Priority priority) { _priority = priority; }
+
+    // Dispatcher worker running continuations. NO_WORKER lets dispatcher choose
+    [[nodiscard]] uint8_t worker() const { return _worker; }
+    void set_worker(uint8_t worker) { _worker = worker; }
+
+    // Executor running continuations instead of Dispatcher, nullptr for default dispatching
+    [[nodiscard]] Executor *executor() const { return _executor; }
+    void set_executor(Executor *executor) { _executor = executor; }
+
+    // Blocks calling task until promise is finished, timeout 0 waits forever. Must not be called from ISR
+    [[nodiscard]] bool wait(unsigned long timeout = 0) const;
+
+    // Same as wait(), but until millis() reaches deadline
+    [[nodiscard]] bool wait_until(unsigned long deadline) const;
+
+    // Callback runs on executor if given, on executor of the promise otherwise
+    void on_finished(FutureFinishedCb callback, Executor *executor = nullptr);
+
+    // Opt-in for producers: handler is called on ::cancel() or deadline expiration of pending promise, e.g. to release its timer.
+    // Replaces previous handler. Handler of a single promise mustn't be set from several tasks at once
+    void set_cancel_handler(PromiseCancelHandler handler);
+
+    // Rejects pending promise and runs its cancel handler. Returns false if promise already finished
+    bool cancel();
+
+    // Absolute millis() time when pending promise is cancelled, 0 if it has no deadline
+    [[nodiscard]] unsigned long deadline() const { return _deadline.load(std::memory_order_relaxed); }
+    [[nodiscard]] bool expired() const;
 
-    [[nodiscard]] bool wait(unsigned long timeout = 0, unsigned long delay_interval = 1) const;
-    void on_finished(FutureFinishedCb callback);
+    // Takes deadline of the parent operation if it is tighter. Sets no timer: the parent expires first,
+    // and its failure reaches this promise through the chain
+    void inherit_deadline(unsigned long deadline);
+
+    // Cancels pending promise at deadline, unless it already has a tighter one. Replaces timer of the looser deadline.
+    // Deadline of a single promise mustn't be set from several tasks at once
+    static void set_deadline(const std::shared_ptr<PromiseBase> &promise, unsigned long deadline, unsigned long slack = 0);
+
+    // Sets timer for inherited deadline of pending promise, once the parent can't enforce it anymore.
+    // E.g. chain waiting for a future returned by continuation. No-op if promise has no deadline or already has timer
+    static void enforce_deadline(const std::shared_ptr<PromiseBase> &promise, unsigned long slack = 0);
 
     static Future<void> all(const std::vector<Future<void>> &collection);
     static Future<void> any(const std::vector<Future<void>> &collection);
 
+    // Succeeds with values of all futures, fails as soon as any of them fails
+    template<typename... Ts>
+    static Future<std::tuple<FutureValue<Ts>...>> all(const Future<Ts> &... futures);
+
+    // Finishes with outcome of the first finished future, variant index tells which one it was
+    template<typename... Ts>
+    static Future<std::variant<FutureValue<Ts>...>> any(const Future<Ts> &... futures);
+
+    // Same as any(), but cancels the rest of futures once the first one finishes
+    template<typename... Ts>
+    static Future<std::variant<FutureValue<Ts>...>> race(const Future<Ts> &... futures);
+
     template<typename T>
     static Future<T> sequential(
         Future<T> first,
-        std::function<bool(const Future<T> &prev)> has_next_fn,
-        std::function<Future<T>(Future<T> prev)> fn);
+        FutureContinuation<bool(const Future<T> &prev)> has_next_fn,
+        FutureContinuation<Future<T>(Future<T> prev)> fn);
 
 protected:
-    portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
-
     PromiseBase() = default;
-    PromiseBase(PromiseBase &&) = default;
 
     void set_success();
     void set_error();
 
+    // Makes the caller the only resolver of the promise. Returns false if promise is already resolved or being resolved
+    bool _claim(const char *action);
+    void _resolve(uintptr_t outcome);
+
+    template<typename T>
+    static std::shared_ptr<Promise<T>> _create(PromiseSite site);
+
 private:
-    void _on_promise_finished();
+    [[nodiscard]] uintptr_t _outcome() const { return _state.load(std::memory_order_acquire) & STATE_OUTCOME_MASK; }
+
+    bool _push_node(Node *node) const;
+    // Removes node still on top of pending list. Fails if newer node is pushed over it or promise is resolved
+    bool _pop_node(Node *node) const;
+    static void _free_node(Node *node);
+
+    void _release_cancel_handler(bool run);
+
+    // Returns false if deadline isn't tighter than the current one
+    bool _tighten_deadline(uint32_t deadline);
+    static void _arm_deadline_timer(const std::shared_ptr<PromiseBase> &promise, uint32_t deadline, unsigned long slack);
+    void _release_deadline_timer();
+    void _on_promise_finished(Node *nodes);
+    bool _wait(TickType_t ticks) const;
+    void _dispatch_callback(FutureFinishedCb &&callback, bool success, Dispatcher::Priority priority, Executor *executor, bool allow_inline) const;
+
+    template<typename... Ts>
+    struct AllState {
+        portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+        std::shared_ptr<Promise<std::tuple<FutureValue<Ts>...>>> result_promise;
+        std::tuple<std::optional<FutureValue<Ts>>...> values;
+        size_t left = sizeof...(Ts);
+        bool failed = false;
+    };
+
+    template<typename... Ts>
+    struct AnyState {
+        typedef std::variant<FutureValue<Ts>...> Result;
+
+        portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+        std::shared_ptr<Promise<Result>> result_promise;
+        // Released by the winner, so pending losers don't keep the state alive
+        std::optional<std::tuple<Future<Ts>...>> futures;
+        bool cancel_losers = false;
+    };
+
+    template<size_t I, typename State, typename T>
+    static void _all_attach(const std::shared_ptr<State> &state, const Future<T> &future);
+
+    template<typename State, size_t... Is, typename... Ts>
+    static void _all_attach_each(const std::shared_ptr<State> &state, std::index_sequence<Is...>, const Future<Ts> &... futures) {
+        (_all_attach<Is>(state, futures), ...);
+    }
+
+    template<size_t I, typename State, typename T>
+    static void _any_attach(const std::shared_ptr<State> &state, const Future<T> &future);
 
-    template<class T>
-    static void _sequential_step(
-        std::shared_ptr<Promise<T>> result_promise, Future<T> first,
-        std::function<bool(const Future<T> &prev)> has_next_fn,
-        std::function<Future<T>(Future<T> prev)> fn);
+    template<typename State, size_t... Is, typename... Ts>
+    static void _any_attach_each(const std::shared_ptr<State> &state, std::index_sequence<Is...>, const Future<Ts> &... futures) {
+        (_any_attach<Is>(state, futures), ...);
+    }
+
+    template<typename... Ts>
+    static Future<std::variant<FutureValue<Ts>...>> _any(bool cancel_losers, const Future<Ts> &... futures);
+
+    template<typename T>
+    struct SequentialState {
+        std::shared_ptr<Promise<T>> result_promise;
+        FutureContinuation<bool(const Future<T> &prev)> has_next_fn;
+        FutureContinuation<Future<T>(Future<T> prev)> fn;
+    };
+
+    template<typename T>
+    static void _sequential_step(std::shared_ptr<SequentialState<T>> state, Future<T> first);
 };
 
 template<typename T>
 class Promise final : public PromiseBase {
-    T _result {};
+    // Constructed on resolution only, so T needs neither default constructor nor copy
+    std::optional<T> _result;
 
 public:
     Promise() = default;
-    Promise(Promise &&) = default;
 
     [[nodiscard]] bool has_result() const override { return true; }
 
-    [[nodiscard]] T result() const;
+    [[nodiscard]] T result() const { return result_ref(); }
+    [[nodiscard]] const T &result_ref() const;
+
+    // Moves result out, after that result isn't available anymore
+    [[nodiscard]] T take();
 
     void set_success(T value);
 
+    // Moves value in only if promise is still pending. Returns false leaving value untouched, e.g. for cancelled promise
+    bool try_set_success(T &value);
+
     using PromiseBase::set_error;
 
-    static std::shared_ptr<Promise> create() { return std::make_shared<Promise>(); }
+    static std::shared_ptr<Promise> create(PromiseSite site = PromiseSite::current()) { return _create<T>(site); }
 };
 
 template<>
 class Promise<void> final : public PromiseBase {
 public:
     Promise() = default;
-    Promise(Promise &&) = default;
 
     using PromiseBase::set_success;
     using PromiseBase::set_error;
 
-    static std::shared_ptr<Promise> create() { return std::make_shared<Promise>(); }
+    static std::shared_ptr<Promise> create(PromiseSite site = PromiseSite::current()) { return _create<void>(site); }
 };
 
 template<typename T>
-T Promise<T>::result() const {
-    if (finished() && success()) return _result;
+std::shared_ptr<Promise<T>> PromiseBase::_create([[maybe_unused]] PromiseSite site) {
+    auto promise = std::allocate_shared<Promise<T>>(PromisePoolAllocator<Promise<T>>());
+
+#if PROMISE_INSTRUMENTATION
+    PromiseTracker::track(promise->_trace, PromiseTracker::type_stats<T>(), site);
+#endif
 
-    D_PRINT("Trying to get value of unfinished or unsuccessful promise");
+    return promise;
+}
+
+template<typename T>
+const T &Promise<T>::result_ref() const {
+    if (finished() && success() && _result.has_value()) return *_result;
+
+    D_PRINT("Trying to get value of unfinished, unsuccessful or taken promise");
     Serial.flush();
 
     abort();
 }
 
+template<typename T>
+T Promise<T>::take() {
+    T result = std::move(const_cast<T &>(result_ref()));
+    _result.reset();
+
+    return result;
+}
+
 template<typename T>
 void Promise<T>::set_success(T value) {
-    portENTER_CRITICAL(&spinlock);
+    try_set_success(value);
+}
 
-    bool already_finished = finished();
-    if (!already_finished) {
-        _result = std::move(value);
-    }
+template<typename T>
+bool Promise<T>::try_set_success(T &value) {
+    if (!_claim("resolve")) return false;
 
-    portEXIT_CRITICAL(&spinlock);
+    // Result is published to readers by the outcome
+    _result.emplace(std::move(value));
+    _resolve(STATE_SUCCESS);
 
-    if (!already_finished) {
-        PromiseBase::set_success();
-    }
+    return true;
+}
+
+template<typename... Ts>
+Future<std::tuple<FutureValue<Ts>...>> PromiseBase::all(const Future<Ts> &... futures) {
+    static_assert(sizeof...(Ts) > 0, "Promise::all(): at least one future is required");
+
+    auto state = std::make_shared<AllState<Ts...>>();
+    auto result_promise = Promise<std::tuple<FutureValue<Ts>...>>::create();
+    state->result_promise = result_promise;
+
+    VERBOSE(D_PRINTF("Promise::all(): Start aggregation of %i typed futures\r\n", sizeof...(Ts)));
+
+    _all_attach_each(state, std::index_sequence_for<Ts...> {}, futures...);
+
+    return result_promise;
+}
+
+template<size_t I, typename State, typename T>
+void PromiseBase::_all_attach(const std::shared_ptr<State> &state, const Future<T> &future) {
+    future.on_finished([state, future](bool success) {
+        // Each slot is written by its own future only, the counter publishes them to the last one
+        if (success) {
+            if constexpr (std::is_void_v<T>) std::get<I>(state->values).emplace();
+            else std::get<I>(state->values).emplace(future.consume());
+        }
+
+        portENTER_CRITICAL(&state->spinlock);
+
+        const bool already_failed = state->failed;
+        if (!success) state->failed = true;
+        const bool completed = success && !already_failed && --state->left == 0;
+
+        portEXIT_CRITICAL(&state->spinlock);
+
+        if (!success && !already_failed) {
+            VERBOSE(D_PRINT("Promise::all(): Finished with result: Error"));
+            state->result_promise->set_error();
+        } else if (completed) {
+            VERBOSE(D_PRINT("Promise::all(): Finished with result: Done"));
+            state->result_promise->set_success(std::apply([](auto &... values) {
+                return std::make_tuple(std::move(*values)...);
+            }, state->values));
+        }
+    });
+}
+
+template<typename... Ts>
+Future<std::variant<FutureValue<Ts>...>> PromiseBase::any(const Future<Ts> &... futures) {
+    return _any(false, futures...);
+}
+
+template<typename... Ts>
+Future<std::variant<FutureValue<Ts>...>> PromiseBase::race(const Future<Ts> &... futures) {
+    return _any(true, futures...);
+}
+
+template<typename... Ts>
+Future<std::variant<FutureValue<Ts>...>> PromiseBase::_any(bool cancel_losers, const Future<Ts> &... futures) {
+    static_assert(sizeof...(Ts) > 0, "Promise::any(): at least one future is required");
+
+    auto state = std::make_shared<AnyState<Ts...>>();
+    auto result_promise = Promise<std::variant<FutureValue<Ts>...>>::create();
+    state->result_promise = result_promise;
+    state->cancel_losers = cancel_losers;
+    state->futures.emplace(futures...);
+
+    result_promise->set_cancel_handler([state] {
+        portENTER_CRITICAL(&state->spinlock);
+        auto pending = std::move(state->futures);
+        state->futures.reset();
+        portEXIT_CRITICAL(&state->spinlock);
+
+        if (pending.has_value()) std::apply([](const auto &... future) { (future.cancel(), ...); }, *pending);
+    });
+
+    VERBOSE(D_PRINTF("Promise::any(): Start aggregation of %i typed futures\r\n", sizeof...(Ts)));
+
+    _any_attach_each(state, std::index_sequence_for<Ts...> {}, futures...);
+
+    return result_promise;
+}
+
+template<size_t I, typename State, typename T>
+void PromiseBase::_any_attach(const std::shared_ptr<State> &state, const Future<T> &future) {
+    future.on_finished([state, future](bool success) {
+        portENTER_CRITICAL(&state->spinlock);
+
+        auto futures = std::move(state->futures);
+        state->futures.reset();
+
+        portEXIT_CRITICAL(&state->spinlock);
+
+        // Only the first finished future finds them
+        if (!futures.has_value()) return;
+
+        VERBOSE(D_PRINTF("Promise::any(): Future %i finished first with result: %s\r\n", I, success ? "Done" : "Error"));
+
+        if (state->cancel_losers) {
+            // Cancelling finished future is no-op, so the winner needs no special case
+            std::apply([](const auto &... pending) { (pending.cancel(), ...); }, *futures);
+        }
+
+        auto &result_promise = state->result_promise;
+        if (!success) {
+            result_promise->set_error();
+        } else if constexpr (std::is_void_v<T>) {
+            result_promise->set_success(typename State::Result(std::in_place_index<I>));
+        } else {
+            result_promise->set_success(typename State::Result(std::in_place_index<I>, future.consume()));
+        }
+    });
 }
 
 template<typename T>
 Future<T> PromiseBase::sequential(
-    Future<T> first, std::function<bool(const Future<T> &prev)> has_next_fn,
-    std::function<Future<T>(Future<T> prev)> fn) {
+    Future<T> first, FutureContinuation<bool(const Future<T> &prev)> has_next_fn,
+    FutureContinuation<Future<T>(Future<T> prev)> fn) {
 
     auto result_promise = Promise<T>::create();
+    auto state = std::make_shared<SequentialState<T>>(SequentialState<T> {
+        .result_promise = result_promise,
+        .has_next_fn = std::move(has_next_fn),
+        .fn = std::move(fn),
+    });
 
     VERBOSE(D_PRINTF("Promise::sequential(): Start sequence (%p)\r\n", result_promise.get()));
-    _sequential_step<T>(result_promise, std::move(first), std::move(has_next_fn), std::move(fn));
+    _sequential_step<T>(std::move(state), std::move(first));
 
     return result_promise;
 }
 
 template<typename T>
-void PromiseBase::_sequential_step(
-    std::shared_ptr<Promise<T>> result_promise, Future<T> first,
-    std::function<bool(const Future<T> &prev)> has_next_fn,
-    std::function<Future<T>(Future<T> prev)> fn) {
-
-    first.on_finished([
-            result_promise, prev=std::move(first),
-            has_next_fn=std::move(has_next_fn), fn = std::move(fn)
-        ](bool success) {
-            VERBOSE(D_PRINTF("Promise::sequential(): Sequence (%p) step promise resolved\r\n", result_promise.get()));
-
-            if (has_next_fn(prev)) {
-                auto next = fn(prev);
-                VERBOSE(D_PRINTF("Promise::sequential(): Sequence (%p) next step\r\n", result_promise.get()));
-
-                _sequential_step(result_promise, std::move(next), std::move(has_next_fn), std::move(fn));
+void PromiseBase::_sequential_step(std::shared_ptr<SequentialState<T>> state, Future<T> first) {
+    // Cancelling the sequence cancels its current step
+    state->result_promise->set_cancel_handler([step = first.weak_promise()] { FutureBase::cancel_weak(step); });
+
+    first.on_finished([state = std::move(state), prev = first](bool success) {
+        auto &result_promise = state->result_promise;
+        VERBOSE(D_PRINTF("Promise::sequential(): Sequence (%p) step promise resolved\r\n", result_promise.get()));
+
+        if (result_promise->finished()) {
+            VERBOSE(D_PRINTF("Promise::sequential(): Sequence (%p) cancelled\r\n", result_promise.get()));
+            return;
+        }
+
+        if (state->has_next_fn(prev)) {
+            auto next = state->fn(prev);
+            VERBOSE(D_PRINTF("Promise::sequential(): Sequence (%p) next step\r\n", result_promise.get()));
+
+            _sequential_step(state, std::move(next));
+        } else {
+            VERBOSE(D_PRINTF("Promise::sequential(): Finished sequence (%p) with result: %s\r\n",
+                result_promise.get(), prev.success() ? "success" : "failed"));
+
+            if (success) {
+                if constexpr (std::is_void_v<T>) result_promise->set_success();
+                else result_promise->set_success(prev.consume());
             } else {
-                VERBOSE(D_PRINTF("Promise::sequential(): Finished sequence (%p) with result: %s\r\n",
-                    result_promise.get(), prev.success() ? "success" : "failed"));
-
-                if (success) {
-                    if constexpr (std::is_void_v<T>) result_promise->set_success();
-                    else result_promise->set_success(prev.result());
-                } else {
-                    result_promise->set_error();
-                }
+                result_promise->set_error();
             }
-        });
+        }
+    });
 }
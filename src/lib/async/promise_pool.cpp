@@ -0,0 +1,73 @@
+#include "promise_pool.h"
+
+#include "../debug.h"
+
+BlockPool<PROMISE_POOL_SMALL_BLOCK_SIZE, PROMISE_POOL_SMALL_BLOCK_COUNT> PromisePool::small_blocks {};
+BlockPool<PROMISE_POOL_LARGE_BLOCK_SIZE, PROMISE_POOL_LARGE_BLOCK_COUNT> PromisePool::large_blocks {};
+
+portMUX_TYPE PromisePool::spinlock = portMUX_INITIALIZER_UNLOCKED;
+PromisePoolStats PromisePool::statistics {};
+
+void *PromisePool::allocate(size_t size) {
+    void *result = nullptr;
+
+    portENTER_CRITICAL(&spinlock);
+
+    if (size <= small_blocks.block_size()) result = small_blocks.allocate();
+    if (result == nullptr && size <= large_blocks.block_size()) result = large_blocks.allocate();
+
+    ++statistics.allocations;
+    if (result == nullptr) ++statistics.heap_allocations;
+
+    portEXIT_CRITICAL(&spinlock);
+
+    if (result == nullptr) {
+        VERBOSE(D_PRINTF("PromisePool: Allocate %u bytes from heap\r\n", size));
+        result = ::operator new(size);
+    }
+
+    return result;
+}
+
+void PromisePool::deallocate(void *ptr) {
+    if (!small_blocks.owns(ptr) && !large_blocks.owns(ptr)) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    portENTER_CRITICAL(&spinlock);
+
+    if (small_blocks.owns(ptr)) {
+        small_blocks.deallocate(ptr);
+    } else {
+        large_blocks.deallocate(ptr);
+    }
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+void PromisePool::count_callback_spill() {
+    portENTER_CRITICAL(&spinlock);
+    ++statistics.callback_spills;
+    portEXIT_CRITICAL(&spinlock);
+}
+
+PromisePoolStats PromisePool::stats() {
+    portENTER_CRITICAL(&spinlock);
+
+    PromisePoolStats result = statistics;
+    result.small_in_use = small_blocks.in_use();
+    result.small_high_water = small_blocks.high_water();
+    result.large_in_use = large_blocks.in_use();
+    result.large_high_water = large_blocks.high_water();
+
+    portEXIT_CRITICAL(&spinlock);
+
+    return result;
+}
+
+void PromisePool::reset_stats() {
+    portENTER_CRITICAL(&spinlock);
+    statistics = {};
+    portEXIT_CRITICAL(&spinlock);
+}
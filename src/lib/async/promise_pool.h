@@ -0,0 +1,77 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <cstddef>
+#include <new>
+
+#include "../misc/block_pool.h"
+
+#ifndef PROMISE_POOL_SMALL_BLOCK_SIZE
+#define PROMISE_POOL_SMALL_BLOCK_SIZE                       (40 * sizeof(void *))
+#endif
+
+#ifndef PROMISE_POOL_SMALL_BLOCK_COUNT
+#define PROMISE_POOL_SMALL_BLOCK_COUNT                      (24u)
+#endif
+
+#ifndef PROMISE_POOL_LARGE_BLOCK_SIZE
+#define PROMISE_POOL_LARGE_BLOCK_SIZE                       (64 * sizeof(void *))
+#endif
+
+#ifndef PROMISE_POOL_LARGE_BLOCK_COUNT
+#define PROMISE_POOL_LARGE_BLOCK_COUNT                      (8u)
+#endif
+
+struct PromisePoolStats {
+    uint32_t allocations = 0;
+    // Allocations which didn't fit any size class or found it exhausted
+    uint32_t heap_allocations = 0;
+    // on_finished callbacks beyond the first one of a promise, each allocates a list node
+    uint32_t callback_spills = 0;
+
+    uint16_t small_in_use = 0;
+    uint16_t small_high_water = 0;
+    uint16_t large_in_use = 0;
+    uint16_t large_high_water = 0;
+};
+
+/**
+ * Allocator of promise control blocks: two fixed size classes with fallback to heap.
+ */
+class PromisePool {
+    static BlockPool<PROMISE_POOL_SMALL_BLOCK_SIZE, PROMISE_POOL_SMALL_BLOCK_COUNT> small_blocks;
+    static BlockPool<PROMISE_POOL_LARGE_BLOCK_SIZE, PROMISE_POOL_LARGE_BLOCK_COUNT> large_blocks;
+
+    static portMUX_TYPE spinlock;
+    static PromisePoolStats statistics;
+
+public:
+    PromisePool() = delete;
+
+    static void *allocate(size_t size);
+    static void deallocate(void *ptr);
+
+    static void count_callback_spill();
+
+    static PromisePoolStats stats();
+    static void reset_stats();
+};
+
+template<typename T>
+struct PromisePoolAllocator {
+    typedef T value_type;
+
+    PromisePoolAllocator() = default;
+    template<typename U> PromisePoolAllocator(const PromisePoolAllocator<U> &) {} // NOLINT(*-explicit-constructor)
+
+    T *allocate(size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "PromisePoolAllocator: Over-aligned types aren't supported");
+        return (T *) PromisePool::allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *ptr, size_t) { PromisePool::deallocate(ptr); }
+
+    template<typename U> bool operator==(const PromisePoolAllocator<U> &) const { return true; }
+    template<typename U> bool operator!=(const PromisePoolAllocator<U> &) const { return false; }
+};
@@ -0,0 +1,187 @@
+#include "promise_tracker.h"
+
+#if PROMISE_INSTRUMENTATION
+
+#include <cstring>
+
+#include "../debug.h"
+
+portMUX_TYPE PromiseTracker::spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+PromiseTypeStats *PromiseTracker::types = nullptr;
+PromiseTrace *PromiseTracker::live = nullptr;
+
+// Cuts "T = int" out of "... type_stats() [with T = int]"
+static void type_name(const char *signature, const char *&name, int &length) {
+    name = strstr(signature, "T = ");
+    if (name == nullptr) {
+        name = signature;
+        length = (int) strlen(signature);
+        return;
+    }
+
+    name += 4;
+    const char *end = strchr(name, ';');
+    if (end == nullptr) end = strrchr(name, ']');
+
+    length = end != nullptr ? (int) (end - name) : (int) strlen(name);
+}
+
+bool PromiseTracker::register_type(PromiseTypeStats &type) {
+    portENTER_CRITICAL(&spinlock);
+    type.next = types;
+    types = &type;
+    portEXIT_CRITICAL(&spinlock);
+
+    return true;
+}
+
+PromiseTypeStats PromiseTracker::stats(const PromiseTypeStats &type) {
+    portENTER_CRITICAL(&spinlock);
+    PromiseTypeStats result = type;
+    portEXIT_CRITICAL(&spinlock);
+
+    result.next = nullptr;
+    return result;
+}
+
+void PromiseTracker::track(PromiseTrace &trace, PromiseTypeStats &type, PromiseSite site) {
+    trace.type = &type;
+    trace.site = site;
+    trace.created_at = esp_timer_get_time();
+
+    portENTER_CRITICAL(&spinlock);
+
+    ++type.created;
+    type.peak = std::max(type.peak, ++type.live);
+
+    trace.next = live;
+    if (live != nullptr) live->prev = &trace;
+    live = &trace;
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+void PromiseTracker::untrack(PromiseTrace &trace) {
+    if (trace.type == nullptr) return;
+
+    portENTER_CRITICAL(&spinlock);
+
+    --trace.type->live;
+    trace.type->callbacks_per_promise.add(trace.callbacks);
+
+    if (trace.prev != nullptr) trace.prev->next = trace.next;
+    else live = trace.next;
+    if (trace.next != nullptr) trace.next->prev = trace.prev;
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+void PromiseTracker::resolved(PromiseTrace &trace) {
+    if (trace.type == nullptr) return;
+
+    const auto elapsed = (uint32_t) (esp_timer_get_time() - trace.created_at);
+
+    portENTER_CRITICAL(&spinlock);
+
+    trace.resolved = true;
+    ++trace.type->resolved;
+    trace.type->resolve_micros.add(elapsed);
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+void PromiseTracker::callback_added(PromiseTrace &trace) {
+    if (trace.type == nullptr) return;
+
+    portENTER_CRITICAL(&spinlock);
+
+    ++trace.callbacks;
+    ++trace.type->callbacks;
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+void PromiseTracker::dump_stats() {
+    portENTER_CRITICAL(&spinlock);
+    auto *type = types;
+    portEXIT_CRITICAL(&spinlock);
+
+    // Types are registered once and never removed, so the list can be walked without the lock
+    for (; type != nullptr; type = type->next) {
+        const auto snapshot = stats(*type);
+
+        const char *name;
+        int name_length;
+        type_name(snapshot.signature, name, name_length);
+
+        D_PRINTF("PromiseTracker: Promise<%.*s>: created %lu, resolved %lu, live %lu, peak %lu, callbacks %lu\r\n",
+            name_length, name, snapshot.created, snapshot.resolved, snapshot.live, snapshot.peak, snapshot.callbacks);
+
+        D_WRITE("PromiseTracker:   resolve us (log2 buckets):");
+        for (auto bucket: snapshot.resolve_micros.buckets) D_PRINTF(" %lu", bucket);
+        D_PRINT("");
+
+        D_WRITE("PromiseTracker:   callbacks per promise (log2 buckets):");
+        for (auto bucket: snapshot.callbacks_per_promise.buckets) D_PRINTF(" %lu", bucket);
+        D_PRINT("");
+    }
+}
+
+uint32_t PromiseTracker::dump_unresolved(unsigned long older_than_ms) {
+    struct Entry {
+        const PromiseTypeStats *type;
+        PromiseSite site;
+        uint32_t age_ms;
+    };
+
+    // Printing is too slow for critical section, so entries are copied first
+    Entry entries[PROMISE_INSTRUMENTATION_DUMP_LIMIT];
+    uint32_t count = 0, total = 0;
+
+    const auto now = (uint64_t) esp_timer_get_time();
+
+    portENTER_CRITICAL(&spinlock);
+
+    for (auto *trace = live; trace != nullptr; trace = trace->next) {
+        const auto age_ms = (uint32_t) ((now - trace->created_at) / 1000);
+        if (trace->resolved || age_ms < older_than_ms) continue;
+
+        if (count < PROMISE_INSTRUMENTATION_DUMP_LIMIT) entries[count++] = {trace->type, trace->site, age_ms};
+        ++total;
+    }
+
+    portEXIT_CRITICAL(&spinlock);
+
+    D_PRINTF("PromiseTracker: %lu promises unresolved for %lu ms or more\r\n", total, older_than_ms);
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *name;
+        int name_length;
+        type_name(entries[i].type->signature, name, name_length);
+
+        D_PRINTF("PromiseTracker:   Promise<%.*s> created at %s:%i, %lu ms ago\r\n",
+            name_length, name, entries[i].site.file, entries[i].site.line, entries[i].age_ms);
+    }
+
+    if (total > count) D_PRINTF("PromiseTracker:   ... and %lu more\r\n", total - count);
+
+    return total;
+}
+
+void PromiseTracker::reset_stats() {
+    portENTER_CRITICAL(&spinlock);
+
+    // Live counts describe existing promises, so they survive the reset
+    for (auto *type = types; type != nullptr; type = type->next) {
+        type->created = 0;
+        type->resolved = 0;
+        type->peak = type->live;
+        type->callbacks = 0;
+        type->resolve_micros.reset();
+        type->callbacks_per_promise.reset();
+    }
+
+    portEXIT_CRITICAL(&spinlock);
+}
+
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "../misc/histogram.h"
+
+// Promise lifecycle tracking: live and peak counts per result type, time to resolve, callbacks per promise
+// and creation sites of unresolved promises. Adds a few words and a global lock to every promise, so it's off by default
+#ifndef PROMISE_INSTRUMENTATION
+#define PROMISE_INSTRUMENTATION                             (0)
+#endif
+
+#ifndef PROMISE_INSTRUMENTATION_HISTOGRAM_SIZE
+#define PROMISE_INSTRUMENTATION_HISTOGRAM_SIZE              (24u)
+#endif
+
+// Max count of unresolved promises printed by a single dump
+#ifndef PROMISE_INSTRUMENTATION_DUMP_LIMIT
+#define PROMISE_INSTRUMENTATION_DUMP_LIMIT                  (32u)
+#endif
+
+/**
+ * Place where promise was created. Filled in by default argument of Promise<T>::create(), so it's the caller's site.
+ * Empty when instrumentation is disabled.
+ */
+struct PromiseSite {
+#if PROMISE_INSTRUMENTATION
+    const char *file = nullptr;
+    int line = 0;
+
+    static constexpr PromiseSite current(const char *file = __builtin_FILE(), int line = __builtin_LINE()) {
+        return {file, line};
+    }
+#else
+    static constexpr PromiseSite current() { return {}; }
+#endif
+};
+
+#if PROMISE_INSTRUMENTATION
+
+struct PromiseTypeStats {
+    // __PRETTY_FUNCTION__ of the type registration, printed as type name
+    const char *signature = nullptr;
+
+    uint32_t created = 0;
+    uint32_t resolved = 0;
+    uint32_t live = 0;
+    uint32_t peak = 0;
+    uint32_t callbacks = 0;
+
+    Log2Histogram<PROMISE_INSTRUMENTATION_HISTOGRAM_SIZE> resolve_micros;
+    Log2Histogram<8> callbacks_per_promise;
+
+    PromiseTypeStats *next = nullptr;
+};
+
+// Per promise part of tracking, embedded into PromiseBase
+struct PromiseTrace {
+    PromiseTypeStats *type = nullptr;
+    PromiseSite site {};
+    uint64_t created_at = 0;
+    uint16_t callbacks = 0;
+    bool resolved = false;
+
+    PromiseTrace *prev = nullptr;
+    PromiseTrace *next = nullptr;
+};
+
+class PromiseTracker {
+    static portMUX_TYPE spinlock;
+
+    static PromiseTypeStats *types;
+    static PromiseTrace *live;
+
+public:
+    PromiseTracker() = delete;
+
+    template<typename T>
+    static PromiseTypeStats &type_stats();
+
+    template<typename T>
+    static PromiseTypeStats stats() { return stats(type_stats<T>()); }
+    static PromiseTypeStats stats(const PromiseTypeStats &type);
+
+    static void track(PromiseTrace &trace, PromiseTypeStats &type, PromiseSite site);
+    static void untrack(PromiseTrace &trace);
+
+    static void resolved(PromiseTrace &trace);
+    static void callback_added(PromiseTrace &trace);
+
+    // Prints counters and histograms of every promise type seen so far
+    static void dump_stats();
+
+    // Prints promises unresolved for at least older_than_ms with their creation sites.
+    // Returns total count of such promises, including ones above dump limit
+    static uint32_t dump_unresolved(unsigned long older_than_ms);
+
+    static void reset_stats();
+
+private:
+    static bool register_type(PromiseTypeStats &type);
+};
+
+template<typename T>
+PromiseTypeStats &PromiseTracker::type_stats() {
+    static PromiseTypeStats type {.signature = __PRETTY_FUNCTION__};
+    static bool registered = register_type(type);
+    (void) registered;
+
+    return type;
+}
+
+#endif
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <optional>
+
+#include "dispatcher.h"
+#include "promise.h"
+#include "system_timer.h"
+#include "../debug.h"
+#include "../misc/histogram.h"
+
+#ifndef RETRY_STATS_HISTOGRAM_SIZE
+#define RETRY_STATS_HISTOGRAM_SIZE                          (20u)
+#endif
+
+struct RetryPolicy {
+    // Total count of attempts, including the first one
+    uint8_t attempts = 1;
+
+    // Delay before the second attempt, multiplied by backoff_factor before each next one
+    unsigned long backoff = 0;
+    uint8_t backoff_factor = 1;
+
+    // Random extra delay in range [0, jitter], so peers failed at the same time don't retry at the same time
+    unsigned long jitter = 0;
+
+    // Time limit of the whole call, 0 for none. Becomes deadline of the result, so expiration cancels pending attempt.
+    // Attempt that can't start before the deadline isn't started at all
+    unsigned long deadline = 0;
+
+    unsigned long slack = 0;
+};
+
+// Outcome of a single attempt. Attempts interrupted by cancellation or deadline aren't reported
+struct RetryAttempt {
+    uint8_t index;
+    bool success;
+
+    // No attempts follow, either because of success or because attempts or time ran out
+    bool last;
+
+    uint32_t latency_micros;
+};
+
+typedef FutureContinuation<void(const RetryAttempt &attempt)> RetryObserver;
+
+// Accumulated attempts of retried calls, filled from RetryObserver
+struct RetryStats {
+    uint32_t calls = 0;
+    uint32_t attempts = 0;
+    uint32_t failed_calls = 0;
+
+    // Attempts used by the most recent finished call
+    uint8_t last_call_attempts = 0;
+
+    Log2Histogram<RETRY_STATS_HISTOGRAM_SIZE> latency_micros;
+
+    void add(const RetryAttempt &attempt) {
+        ++attempts;
+        latency_micros.add(attempt.latency_micros);
+
+        if (!attempt.last) return;
+
+        ++calls;
+        if (!attempt.success) ++failed_calls;
+        last_call_attempts = attempt.index + 1;
+    }
+};
+
+/**
+ * State of a single retry() call. Allocated once per call and reused by every attempt,
+ * so attempts and delays between them capture only pointer to it.
+ */
+template<typename T>
+class RetryOperation {
+public:
+    typedef FutureContinuation<Future<T>(uint8_t attempt)> AttemptFn;
+
+private:
+    typedef std::shared_ptr<RetryOperation> Ptr;
+
+    portMUX_TYPE _spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+    std::shared_ptr<Promise<T>> _result;
+    AttemptFn _fn;
+    RetryPolicy _policy;
+    RetryObserver _observer;
+
+    uint64_t _attempt_started_at = 0;
+    unsigned long _backoff;
+    uint8_t _attempt = 0;
+    bool _finished = false;
+
+    // Attempt or delay in progress, stopped by cancellation and deadline
+    std::optional<Future<T>> _pending;
+    TimerHandle _backoff_timer;
+
+public:
+    RetryOperation(AttemptFn &&fn, const RetryPolicy &policy, RetryObserver &&observer) :
+        _result(Promise<T>::create()), _fn(std::move(fn)), _policy(policy), _observer(std::move(observer)),
+        _backoff(policy.backoff) {}
+
+    static Future<T> start(AttemptFn &&fn, const RetryPolicy &policy, RetryObserver &&observer);
+
+private:
+    static void _run_attempt(const Ptr &self);
+    static void _on_attempt_finished(const Ptr &self, const Future<T> &future, bool success);
+    static void _schedule_attempt(const Ptr &self, unsigned long delay);
+    static void _fail(const Ptr &self);
+
+    unsigned long _next_delay();
+
+    // Returns false if operation is already finished by someone else
+    bool _claim_finish();
+    void _stop_pending();
+};
+
+/**
+ * Calls fn until its future succeeds or policy runs out of attempts or time, fn gets 0-based attempt index.
+ * Attempts run strictly one after another: the next one starts from Dispatcher after backoff delay.
+ * Cancelling the result cancels pending attempt. Observer is called after each finished attempt.
+ */
+template<typename T>
+Future<T> retry(FutureContinuation<Future<T>(uint8_t attempt)> fn, const RetryPolicy &policy, RetryObserver observer = nullptr) {
+    return RetryOperation<T>::start(std::move(fn), policy, std::move(observer));
+}
+
+template<typename T>
+Future<T> RetryOperation<T>::start(AttemptFn &&fn, const RetryPolicy &policy, RetryObserver &&observer) {
+    auto self = std::allocate_shared<RetryOperation>(
+        PromisePoolAllocator<RetryOperation>(), std::move(fn), policy, std::move(observer));
+
+    auto result = self->_result;
+    if (policy.attempts == 0) {
+        result->set_error();
+        return result;
+    }
+
+    result->set_cancel_handler([self] {
+        if (!self->_claim_finish()) return;
+
+        VERBOSE(D_PRINTF("retry(): Operation (%p) cancelled\r\n", self.get()));
+        self->_stop_pending();
+    });
+
+    // Expiration cancels pending attempt through the cancel handler, attempt futures are never changed
+    Future<T> future = result;
+    future.cancel_after(policy.deadline, policy.slack);
+
+    _run_attempt(self);
+    return future;
+}
+
+template<typename T>
+void RetryOperation<T>::_run_attempt(const Ptr &self) {
+    portENTER_CRITICAL(&self->_spinlock);
+    const bool finished = self->_finished;
+    const auto attempt = self->_attempt;
+    self->_backoff_timer = {};
+    portEXIT_CRITICAL(&self->_spinlock);
+
+    if (finished) return;
+
+    VERBOSE(D_PRINTF("retry(): Operation (%p) attempt #%u\r\n", self.get(), attempt + 1));
+
+    // Attempts never overlap, so the rest of the state needs no lock
+    self->_attempt_started_at = esp_timer_get_time();
+    auto future = self->_fn(attempt);
+
+    portENTER_CRITICAL(&self->_spinlock);
+    const bool stopped = self->_finished;
+    if (!stopped) self->_pending.emplace(future);
+    portEXIT_CRITICAL(&self->_spinlock);
+
+    if (stopped) {
+        future.cancel();
+        return;
+    }
+
+    future.on_finished([self, future](bool success) { _on_attempt_finished(self, future, success); });
+}
+
+template<typename T>
+void RetryOperation<T>::_on_attempt_finished(const Ptr &self, const Future<T> &future, bool success) {
+    const auto latency_micros = (uint32_t) (esp_timer_get_time() - self->_attempt_started_at);
+
+    const auto attempt = self->_attempt++;
+    bool last = success || self->_attempt >= self->_policy.attempts;
+
+    unsigned long delay = 0;
+    if (!last) {
+        delay = self->_next_delay();
+        const auto deadline = (uint32_t) self->_result->deadline();
+        if (deadline != 0 && (int32_t) ((uint32_t) millis() + delay - deadline) >= 0) last = true;
+    }
+
+    portENTER_CRITICAL(&self->_spinlock);
+    const bool stopped = self->_finished;
+    self->_pending.reset();
+    if (last) self->_finished = true;
+    portEXIT_CRITICAL(&self->_spinlock);
+
+    if (stopped) return;
+
+    if (self->_observer) self->_observer({attempt, success, last, latency_micros});
+
+    if (!last) return _schedule_attempt(self, delay);
+
+    VERBOSE(D_PRINTF("retry(): Operation (%p) finished after %u attempts with result: %s\r\n",
+        self.get(), attempt + 1, success ? "success" : "failed"));
+
+    auto &result = self->_result;
+    if (!success) {
+        result->set_error();
+    } else if constexpr (std::is_void_v<T>) {
+        result->set_success();
+    } else {
+        result->set_success(future.consume());
+    }
+}
+
+template<typename T>
+void RetryOperation<T>::_schedule_attempt(const Ptr &self, unsigned long delay) {
+    // Even without delay the next attempt goes through Dispatcher,
+    // so attempts failing immediately don't nest into each other
+    if (delay == 0) {
+        if (!Dispatcher::dispatch([self] { _run_attempt(self); })) _fail(self);
+        return;
+    }
+
+    auto timer = SystemTimer::set_timeout(delay, [self] {
+        if (!Dispatcher::dispatch([self] { _run_attempt(self); })) _fail(self);
+    }, self->_policy.slack);
+
+    portENTER_CRITICAL(&self->_spinlock);
+    const bool stopped = self->_finished;
+    if (!stopped) self->_backoff_timer = timer;
+    portEXIT_CRITICAL(&self->_spinlock);
+
+    if (!timer) {
+        D_PRINT("retry(): Unable to set backoff timer");
+        _fail(self);
+    } else if (stopped) {
+        timer.cancel();
+    }
+}
+
+template<typename T>
+void RetryOperation<T>::_fail(const Ptr &self) {
+    if (!self->_claim_finish()) return;
+
+    self->_stop_pending();
+    self->_result->set_error();
+}
+
+template<typename T>
+unsigned long RetryOperation<T>::_next_delay() {
+    auto delay = _backoff;
+
+    const auto factor = std::max<uint8_t>(_policy.backoff_factor, 1);
+    _backoff = _backoff <= ULONG_MAX / factor ? _backoff * factor : ULONG_MAX;
+
+    if (_policy.jitter > 0) delay += esp_random() % (_policy.jitter + 1);
+    return delay;
+}
+
+template<typename T>
+bool RetryOperation<T>::_claim_finish() {
+    portENTER_CRITICAL(&_spinlock);
+    const bool claimed = !_finished;
+    _finished = true;
+    portEXIT_CRITICAL(&_spinlock);
+
+    return claimed;
+}
+
+template<typename T>
+void RetryOperation<T>::_stop_pending() {
+    portENTER_CRITICAL(&_spinlock);
+    auto pending = std::move(_pending);
+    _pending.reset();
+    const auto backoff_timer = _backoff_timer;
+    portEXIT_CRITICAL(&_spinlock);
+
+    backoff_timer.cancel();
+    if (pending.has_value()) pending->cancel();
+}
@@ -6,47 +6,223 @@
 bool SystemTimer::initialized = false;
 uint64_t SystemTimer::begin_processing_micros = 0;
 int SystemTimer::processed_tasks = 0;
+TaskHandle_t SystemTimer::task_handle = nullptr;
 
-SystemTimer::PriorityQueue SystemTimer::timers {};
+SystemTimer::TimerQueue SystemTimer::timers {};
 portMUX_TYPE SystemTimer::spinlock = portMUX_INITIALIZER_UNLOCKED;
 
-Future<void> SystemTimer::delay(unsigned long timeout_ms) {
+SystemTimerStats SystemTimer::statistics {};
+
+Future<void> SystemTimer::delay(unsigned long timeout_ms, unsigned long slack_ms) {
     auto promise = Promise<void>::create();
     auto callback = [=] {
         promise->set_success();
     };
 
-    if (!set_timeout(timeout_ms, std::move(callback))) {
+    auto timer = set_timeout(timeout_ms, std::move(callback), slack_ms);
+    if (!timer) {
         promise->set_error();
+    } else {
+        promise->set_cancel_handler([timer] { timer.cancel(); });
     }
 
     return Future {promise};
 }
 
-bool SystemTimer::set_timeout(unsigned long timeout_ms, CallbackType callback) {
-    if (callback == nullptr) return false;
+bool TimerHandle::cancel() const {
+    return SystemTimer::cancel(*this);
+}
+
+struct SystemTimerInterval {
+    SystemTimer::CallbackType callback;
+    uint64_t period;
+    uint64_t slack;
+
+    // Nominal deadline of the next tick, before coalescing
+    uint64_t next_at;
+
+    TimerHandle timer;
+    bool cancelled = false;
+};
+
+bool IntervalHandle::cancel() const {
+    return SystemTimer::cancel(*this);
+}
+
+TimerHandle SystemTimer::set_timeout(unsigned long timeout_ms, CallbackType callback, unsigned long slack_ms) {
+    if (callback == nullptr) return {};
+
+    return schedule(esp_timer_get_time() + timeout_ms * 1000ull, slack_ms * 1000ull, std::move(callback));
+}
+
+TimerHandle SystemTimer::schedule(uint64_t timeout_at, uint64_t slack, CallbackType &&callback) {
+#if SYSTEM_TIMER_BACKEND == SYSTEM_TIMER_BACKEND_WHEEL
+    // Allocated outside of critical section when the pool is exhausted. Freed on return if nobody needed it
+    TimerQueue::Chunk chunk;
+#endif
 
     portENTER_CRITICAL(&spinlock);
 
     if (!initialized) {
         if (!start_task()) {
             portEXIT_CRITICAL(&spinlock);
-            return false;
+            return {};
         }
 
         initialized = true;
     }
 
-    timers.push({.timeout_at = millis64() + timeout_ms, .callback = std::move(callback)});
+#if SYSTEM_TIMER_BACKEND == SYSTEM_TIMER_BACKEND_WHEEL
+    while (timers.full()) {
+        // Another task may have grown the pool meanwhile, then the chunk isn't needed
+        if (chunk && timers.add_chunk(chunk)) break;
+
+        const bool can_grow = !chunk && timers.can_grow() && !xPortInIsrContext();
+        portEXIT_CRITICAL(&spinlock);
+
+        if (!can_grow) {
+            if (!xPortInIsrContext()) D_PRINT("SystemTimer: Unable to allocate timer");
+            return {};
+        }
+
+        chunk = TimerQueue::allocate_chunk();
+        portENTER_CRITICAL(&spinlock);
+    }
+#endif
+
+    timeout_at = coalesce(timeout_at, slack);
+    const bool earliest = timeout_at < timers.next_deadline();
+
+    const auto id = timers.push(timeout_at, std::move(callback));
+    if (id == TimerQueue::INVALID_ID) {
+        portEXIT_CRITICAL(&spinlock);
+
+        if (!xPortInIsrContext()) D_PRINT("SystemTimer: Unable to allocate timer");
+        return {};
+    }
+
+    ++statistics.scheduled;
+    statistics.pending_high_water = std::max<uint32_t>(statistics.pending_high_water, timers.size());
+    if (earliest) ++statistics.rearms;
+
     portEXIT_CRITICAL(&spinlock);
 
     VERBOSE(D_PRINTF("SystemTimer: Add new task. Total: %i\r\n", timers.size()));
-    return true;
+
+    // Timer task sleeps until the earliest deadline, so wake it only when the deadline moves closer.
+    // Timer task itself recalculates the deadline before going to sleep
+    if (earliest && (xPortInIsrContext() || xTaskGetCurrentTaskHandle() != task_handle)) rearm();
+
+    return TimerHandle {id};
+}
+
+IntervalHandle SystemTimer::set_interval(unsigned long period_ms, CallbackType callback, unsigned long slack_ms) {
+    if (callback == nullptr || period_ms == 0) return {};
+
+    auto interval = std::make_shared<SystemTimerInterval>();
+    interval->callback = std::move(callback);
+    interval->period = period_ms * 1000ull;
+    interval->slack = slack_ms * 1000ull;
+    interval->next_at = esp_timer_get_time() + interval->period;
+
+    auto timer = schedule(interval->next_at, interval->slack, [interval] { run_interval(interval); });
+    if (!timer) return {};
+
+    portENTER_CRITICAL(&spinlock);
+    interval->timer = timer;
+    portEXIT_CRITICAL(&spinlock);
+
+    return IntervalHandle {interval};
+}
+
+bool SystemTimer::cancel(const IntervalHandle &handle) {
+    auto interval = handle._interval.lock();
+    if (!interval) return false;
+
+    portENTER_CRITICAL(&spinlock);
+    const bool already_cancelled = interval->cancelled;
+    interval->cancelled = true;
+    const auto timer = interval->timer;
+    portEXIT_CRITICAL(&spinlock);
+
+    // When interval callback is running, its timer is already gone and run_interval() won't schedule next one
+    cancel(timer);
+    return !already_cancelled;
+}
+
+void SystemTimer::run_interval(const std::shared_ptr<SystemTimerInterval> &interval) {
+    portENTER_CRITICAL(&spinlock);
+    const bool cancelled_before = interval->cancelled;
+    portEXIT_CRITICAL(&spinlock);
+
+    // Cancelled after timer was taken from the queue
+    if (cancelled_before) return;
+
+    interval->callback();
+
+    const auto now = (uint64_t) esp_timer_get_time();
+    interval->next_at += interval->period;
+
+    if (interval->next_at <= now) {
+        const auto skipped = (now - interval->next_at) / interval->period + 1;
+        interval->next_at += skipped * interval->period;
+
+        statistics.skipped_intervals += skipped;
+        VERBOSE(D_PRINTF("SystemTimer: Interval skipped %llu periods\r\n", skipped));
+    }
+
+    portENTER_CRITICAL(&spinlock);
+    const bool cancelled = interval->cancelled;
+    portEXIT_CRITICAL(&spinlock);
+
+    if (cancelled) return;
+
+    const auto timer = schedule(interval->next_at, interval->slack, [interval] { run_interval(interval); });
+    if (!timer) {
+        D_PRINT("SystemTimer: Unable to schedule next interval tick");
+        return;
+    }
+
+    portENTER_CRITICAL(&spinlock);
+    interval->timer = timer;
+    const bool cancelled_meanwhile = interval->cancelled;
+    portEXIT_CRITICAL(&spinlock);
+
+    if (cancelled_meanwhile) cancel(timer);
+}
+
+bool SystemTimer::cancel(const TimerHandle &handle) {
+    if (!handle) return false;
+
+    // Callback is destroyed outside of critical section: it may own the last reference to a promise
+    CallbackType callback;
+
+    portENTER_CRITICAL(&spinlock);
+    const bool cancelled = timers.cancel(handle.id(), callback);
+    if (cancelled) ++statistics.cancelled;
+    portEXIT_CRITICAL(&spinlock);
+
+    if (cancelled) VERBOSE(D_PRINTF("SystemTimer: Timer %lu cancelled\r\n", handle.id()));
+    return cancelled;
+}
+
+SystemTimerStats SystemTimer::stats() {
+    portENTER_CRITICAL(&spinlock);
+    SystemTimerStats result = statistics;
+    portEXIT_CRITICAL(&spinlock);
+
+    return result;
+}
+
+void SystemTimer::reset_stats() {
+    portENTER_CRITICAL(&spinlock);
+    statistics = {};
+    portEXIT_CRITICAL(&spinlock);
 }
 
 bool SystemTimer::start_task() {
     auto ret = xTaskCreatePinnedToCore(timer_task, "TimerCbTask",
-        SYSTEM_TIMER_STACK_SIZE, nullptr, SYSTEM_TIMER_TASK_PRIORITY, nullptr, xPortGetCoreID());
+        SYSTEM_TIMER_STACK_SIZE, nullptr, SYSTEM_TIMER_TASK_PRIORITY, &task_handle, xPortGetCoreID());
 
     if (ret != pdPASS) {
         D_PRINTF("SystemTimer: Failed to start task: %x\r\n", pdPASS);
@@ -67,44 +243,85 @@ bool SystemTimer::start_task() {
             if (has_pending) delay_if_too_long();
         } while (has_pending);
 
+        if (processed_tasks > 1) ++statistics.coalesced_wakeups;
         if (processed_tasks > 0) VERBOSE(D_PRINT("SystemTimer: Waiting for new timer..."));
-        delayMicroseconds(SYSTEM_TIMER_DELAY_INTERVAL_MICRO);
+        ulTaskNotifyTake(pdTRUE, next_wait_ticks());
+
+        ++statistics.wakeups;
     }
 }
 
-bool SystemTimer::process_pending_tasks() {
+void SystemTimer::rearm() {
+    if (xPortInIsrContext()) {
+        vTaskNotifyGiveFromISR(task_handle, nullptr);
+    } else {
+        xTaskNotifyGive(task_handle);
+    }
+}
+
+uint64_t SystemTimer::coalesce(uint64_t timeout_at, uint64_t slack) {
+    if (slack == 0) return timeout_at;
+
+    // Join the next scheduled wakeup when it fits the window
+    const auto next_deadline = timers.next_deadline();
+    if (next_deadline >= timeout_at && next_deadline <= timeout_at + slack) return next_deadline;
+
+    // Otherwise align to the coarsest power of two within slack, so timers with overlapping windows share a boundary
+    const uint64_t granularity = 1ull << (63 - __builtin_clzll(slack));
+    return (timeout_at + granularity - 1) & ~(granularity - 1);
+}
+
+TickType_t SystemTimer::next_wait_ticks() {
     portENTER_CRITICAL(&spinlock);
-    bool has_pending = has_pending_task();
+    const auto timeout_at = timers.next_deadline();
+    portEXIT_CRITICAL(&spinlock);
 
-    if (!has_pending) {
-        portEXIT_CRITICAL(&spinlock);
-        return false;
-    }
+    if (timeout_at == UINT64_MAX) return portMAX_DELAY;
 
-    if (processed_tasks == 0) VERBOSE(D_PRINT("SystemTimer: Timers are ready. Processing..."));
+    const auto now = (uint64_t) esp_timer_get_time();
+    if (timeout_at <= now) return 0;
 
-    auto timer_task = std::move(const_cast<TimerTask &>(timers.top()));
-    timers.pop();
-    has_pending = has_pending_task();
+    // Extra tick covers partially elapsed current tick
+    return (TickType_t) std::min<uint64_t>(pdMS_TO_TICKS((timeout_at - now) / 1000) + 1, portMAX_DELAY - 1);
+}
 
+bool SystemTimer::process_pending_tasks() {
+    CallbackType callback;
+    uint64_t timeout_at;
+
+    portENTER_CRITICAL(&spinlock);
+    const bool ready = timers.pop_expired(esp_timer_get_time(), callback, timeout_at);
     portEXIT_CRITICAL(&spinlock);
 
-    VERBOSE(D_PRINTF("SystemTimer: Triggered at %llu (late for %llu ms). Left: %lu\r\n",
-        timer_task.timeout_at, millis64() - timer_task.timeout_at, timers.size()));
+    if (!ready) return false;
 
-    timer_task.callback();
+    if (processed_tasks == 0) VERBOSE(D_PRINT("SystemTimer: Timers are ready. Processing..."));
+
+    const auto started_at = esp_timer_get_time();
+    const auto lateness = (uint32_t) (started_at - timeout_at);
+
+    VERBOSE(D_PRINTF("SystemTimer: Triggered at %llu (late for %lu us). Left: %lu\r\n",
+        timeout_at, lateness, (uint32_t) timers.size()));
+
+    callback();
     ++processed_tasks;
 
-    return has_pending;
-}
+    const auto execution_time = (uint32_t) (esp_timer_get_time() - started_at);
+
+    ++statistics.fired;
+    statistics.lateness_micros.add(lateness);
+    statistics.max_lateness_micros = std::max(statistics.max_lateness_micros, lateness);
+    statistics.execution_micros.add(execution_time);
+    statistics.total_execution_micros += execution_time;
+    statistics.max_execution_micros = std::max(statistics.max_execution_micros, execution_time);
 
-bool SystemTimer::has_pending_task() {
-    return !timers.empty() && timers.top().timeout_at < millis64();
+    return true;
 }
 
 void SystemTimer::delay_if_too_long() {
     if (esp_timer_get_time() - begin_processing_micros > SYSTEM_TIMER_TASK_RUNNING_TIMEOUT_MICRO) {
         vTaskDelay(0);
+        ++statistics.yields;
 
         VERBOSE(D_PRINT("SystemTimer: Too long task execution. Wait before continue"));
         begin_processing_micros = esp_timer_get_time();
@@ -1,8 +1,31 @@
 #pragma once
 
 #include <Arduino.h>
-#include <functional>
-#include <queue>
+
+#include <memory>
+
+#include "../misc/histogram.h"
+#include "../misc/inplace_function.h"
+#include "../misc/timer_heap.h"
+#include "../misc/timing_wheel.h"
+
+#define SYSTEM_TIMER_BACKEND_HEAP                           (0)
+#define SYSTEM_TIMER_BACKEND_WHEEL                          (1)
+
+#ifndef SYSTEM_TIMER_BACKEND
+#define SYSTEM_TIMER_BACKEND                                SYSTEM_TIMER_BACKEND_WHEEL
+#endif
+
+// Count of preallocated timers for SYSTEM_TIMER_BACKEND_WHEEL. Covers deadlines, retries and intervals of a loaded hub,
+// beyond that the wheel takes more chunks of the same size, allocated outside of the timer lock
+#ifndef SYSTEM_TIMER_WHEEL_CAPACITY
+#define SYSTEM_TIMER_WHEEL_CAPACITY                         (128u)
+#endif
+
+// Limit of timer chunks, scheduling fails beyond that
+#ifndef SYSTEM_TIMER_WHEEL_MAX_CHUNKS
+#define SYSTEM_TIMER_WHEEL_MAX_CHUNKS                       (16u)
+#endif
 
 #ifndef SYSTEM_TIMER_STACK_SIZE
 #define SYSTEM_TIMER_STACK_SIZE                             (4096u)
@@ -12,49 +35,122 @@
 #define SYSTEM_TIMER_TASK_PRIORITY                          (1u)
 #endif
 
-#ifndef SYSTEM_TIMER_DELAY_INTERVAL_MICRO
-#define SYSTEM_TIMER_DELAY_INTERVAL_MICRO                   (1000u)
+#ifndef SYSTEM_TIMER_CALLBACK_CAPACITY
+#define SYSTEM_TIMER_CALLBACK_CAPACITY                      (4 * sizeof(void *))
 #endif
 
 #ifndef SYSTEM_TIMER_TASK_RUNNING_TIMEOUT_MICRO
 #define SYSTEM_TIMER_TASK_RUNNING_TIMEOUT_MICRO             (100)
 #endif
 
+#ifndef SYSTEM_TIMER_STATS_HISTOGRAM_SIZE
+#define SYSTEM_TIMER_STATS_HISTOGRAM_SIZE                   (16u)
+#endif
+
 template<typename T> class Future;
 
+struct SystemTimerStats {
+    uint32_t scheduled = 0;
+    uint32_t fired = 0;
+    uint32_t cancelled = 0;
+    uint32_t yields = 0;
+    uint32_t wakeups = 0;
+    // Wakeups which fired more than one timer
+    uint32_t coalesced_wakeups = 0;
+    uint32_t rearms = 0;
+    uint32_t pending_high_water = 0;
+    // Interval periods skipped because previous callback finished too late
+    uint32_t skipped_intervals = 0;
+
+    uint32_t max_lateness_micros = 0;
+    uint64_t total_execution_micros = 0;
+    uint32_t max_execution_micros = 0;
+
+    Log2Histogram<SYSTEM_TIMER_STATS_HISTOGRAM_SIZE> lateness_micros;
+    Log2Histogram<SYSTEM_TIMER_STATS_HISTOGRAM_SIZE> execution_micros;
+};
+
+class TimerHandle {
+    uint32_t _id = 0;
+
+public:
+    TimerHandle() = default;
+    explicit TimerHandle(uint32_t id) : _id(id) {}
+
+    // Returns false if timer already fired or cancelled
+    bool cancel() const; // NOLINT(*-use-nodiscard)
+
+    [[nodiscard]] uint32_t id() const { return _id; }
+    explicit operator bool() const { return _id != 0; }
+};
+
+struct SystemTimerInterval;
+
+class IntervalHandle {
+    std::weak_ptr<SystemTimerInterval> _interval;
+
+    friend class SystemTimer;
+
+public:
+    IntervalHandle() = default;
+    explicit IntervalHandle(const std::shared_ptr<SystemTimerInterval> &interval) : _interval(interval) {}
+
+    // Stops interval. Safe to call from interval callback
+    bool cancel() const; // NOLINT(*-use-nodiscard)
+
+    // True until interval is cancelled
+    explicit operator bool() const { return !_interval.expired(); }
+};
+
 class SystemTimer {
-    struct TimerTask;
+public:
+    typedef InplaceFunction<void(), SYSTEM_TIMER_CALLBACK_CAPACITY> CallbackType;
+
+private:
+#if SYSTEM_TIMER_BACKEND == SYSTEM_TIMER_BACKEND_WHEEL
+    typedef TimingWheel<CallbackType, SYSTEM_TIMER_WHEEL_CAPACITY, SYSTEM_TIMER_WHEEL_MAX_CHUNKS> TimerQueue;
+#else
+    typedef TimerHeap<CallbackType> TimerQueue;
+#endif
 
     static bool initialized;
     static uint64_t begin_processing_micros;
     static int processed_tasks;
+    static TaskHandle_t task_handle;
 
-    typedef std::priority_queue<TimerTask, std::vector<TimerTask>, std::greater<>> PriorityQueue;
-    static PriorityQueue timers;
+    static TimerQueue timers;
     static portMUX_TYPE spinlock;
 
+    static SystemTimerStats statistics;
+
 public:
-    typedef std::function<void()> CallbackType;
     SystemTimer() = delete;
 
-    static Future<void> delay(unsigned long timeout_ms);
-    static bool set_timeout(unsigned long timeout_ms, CallbackType callback);
+    static Future<void> delay(unsigned long timeout_ms, unsigned long slack_ms = 0);
 
-private:
-    struct TimerTask {
-        uint64_t timeout_at;
-        CallbackType callback;
+    // Timer fires within [timeout_ms, timeout_ms + slack_ms], so close timers can share one wakeup.
+    // Returns empty handle on failure
+    static TimerHandle set_timeout(unsigned long timeout_ms, CallbackType callback, unsigned long slack_ms = 0);
+    static bool cancel(const TimerHandle &handle);
 
-        bool operator>(const TimerTask &other) const { return timeout_at > other.timeout_at; }
-    };
+    // Phase-locked periodic timer: each deadline is the previous deadline plus period, so callback latency doesn't
+    // accumulate. Periods missed by a slow callback are skipped rather than fired in a burst
+    static IntervalHandle set_interval(unsigned long period_ms, CallbackType callback, unsigned long slack_ms = 0);
+    static bool cancel(const IntervalHandle &handle);
 
+    static SystemTimerStats stats();
+    static void reset_stats();
+
+private:
     static bool start_task();
-    static void timer_task(void *arg);
+    static void rearm();
+    [[noreturn]] static void timer_task(void *arg);
 
+    static TimerHandle schedule(uint64_t timeout_at, uint64_t slack, CallbackType &&callback);
+    static void run_interval(const std::shared_ptr<SystemTimerInterval> &interval);
+
+    static uint64_t coalesce(uint64_t timeout_at, uint64_t slack);
+    static TickType_t next_wait_ticks();
     static bool process_pending_tasks();
-    static bool has_pending_task();
     static void delay_if_too_long();
-
-    // Actually it's ~ 53 bits, but it doesn't really matter...
-    static uint64_t millis64() { return esp_timer_get_time() / 1000; }
 };
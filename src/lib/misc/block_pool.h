@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Preallocated pool of fixed size blocks with intrusive free list. Not thread-safe.
+ * Blocks are handed out lazily, so static pools are usable before dynamic initialization.
+ */
+template<size_t BlockSize, uint16_t Count>
+class BlockPool {
+    static_assert(BlockSize >= sizeof(void *), "BlockPool: BlockSize is too small");
+    static_assert(Count > 0, "BlockPool: Count must be positive");
+
+    union Block {
+        Block *next;
+        alignas(std::max_align_t) uint8_t data[BlockSize];
+    };
+
+    Block _blocks[Count] {};
+    Block *_free = nullptr;
+    uint16_t _untouched = 0;
+
+    uint16_t _in_use = 0;
+    uint16_t _high_water = 0;
+
+public:
+    constexpr BlockPool() = default;
+
+    BlockPool(const BlockPool &) = delete;
+    BlockPool &operator=(BlockPool const &) = delete;
+
+    // Returns nullptr when pool is exhausted
+    void *allocate();
+    void deallocate(void *ptr);
+
+    [[nodiscard]] bool owns(const void *ptr) const { return ptr >= (const void *) _blocks && ptr < (const void *) (_blocks + Count); }
+
+    [[nodiscard]] uint16_t in_use() const { return _in_use; }
+    [[nodiscard]] uint16_t high_water() const { return _high_water; }
+
+    static constexpr size_t block_size() { return BlockSize; }
+    static constexpr uint16_t capacity() { return Count; }
+};
+
+template<size_t BlockSize, uint16_t Count>
+void *BlockPool<BlockSize, Count>::allocate() {
+    Block *block;
+    if (_free != nullptr) {
+        block = _free;
+        _free = block->next;
+    } else if (_untouched < Count) {
+        block = &_blocks[_untouched++];
+    } else {
+        return nullptr;
+    }
+
+    if (++_in_use > _high_water) _high_water = _in_use;
+    return block->data;
+}
+
+template<size_t BlockSize, uint16_t Count>
+void BlockPool<BlockSize, Count>::deallocate(void *ptr) {
+    auto block = (Block *) ptr;
+    block->next = _free;
+    _free = block;
+
+    --_in_use;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Fixed size histogram with power of two buckets: bucket N counts values in range [2^N, 2^(N+1)).
+ * Zero goes to the first bucket, values above the range go to the last one.
+ */
+template<uint8_t Size>
+struct Log2Histogram {
+    static_assert(Size > 0 && Size <= 32, "Log2Histogram: Size must be in range [1, 32]");
+
+    uint32_t buckets[Size] {};
+
+    void add(uint32_t value) { ++buckets[bucket_index(value)]; }
+    void reset() { for (auto &bucket: buckets) bucket = 0; }
+
+    [[nodiscard]] uint32_t total() const {
+        uint32_t result = 0;
+        for (auto bucket: buckets) result += bucket;
+
+        return result;
+    }
+
+    static uint8_t bucket_index(uint32_t value) {
+        if (value == 0) return 0;
+
+        const auto index = (uint8_t) (31 - __builtin_clz(value));
+        return index < Size ? index : Size - 1;
+    }
+
+    static constexpr uint8_t size() { return Size; }
+};
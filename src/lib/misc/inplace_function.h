@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <lib/debug.h>
+
+#ifndef INPLACE_FUNCTION_DEFAULT_CAPACITY
+#define INPLACE_FUNCTION_DEFAULT_CAPACITY       (4 * sizeof(void *))
+#endif
+
+template<typename Signature, size_t Capacity = INPLACE_FUNCTION_DEFAULT_CAPACITY>
+class InplaceFunction;
+
+/**
+ * Move-only replacement of std::function which never allocates.
+ *
+ * The callable is stored in a fixed buffer of Capacity bytes; a capture that doesn't fit fails to compile.
+ */
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+    static constexpr size_t ALIGNMENT = alignof(uint64_t);
+
+    struct VTable {
+        R (*invoke)(void *storage, Args &&... args);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *storage);
+    };
+
+    template<typename F>
+    static constexpr VTable VTABLE_FOR = {
+        .invoke = [](void *storage, Args &&... args) -> R {
+            auto &fn = *std::launder(reinterpret_cast<F *>(storage));
+            if constexpr (std::is_void_v<R>) fn(std::forward<Args>(args)...);
+            else return fn(std::forward<Args>(args)...);
+        },
+        .move = [](void *dst, void *src) {
+            auto *src_fn = std::launder(reinterpret_cast<F *>(src));
+            new(dst) F(std::move(*src_fn));
+            src_fn->~F();
+        },
+        .destroy = [](void *storage) {
+            std::launder(reinterpret_cast<F *>(storage))->~F();
+        },
+    };
+
+    alignas(ALIGNMENT) mutable uint8_t _storage[Capacity]; // NOLINT(*-pro-type-member-init)
+    const VTable *_vtable = nullptr;
+
+public:
+    InplaceFunction() = default;
+    InplaceFunction(std::nullptr_t) {} // NOLINT(*-explicit-constructor)
+
+    template<typename F, typename D = std::decay_t<F>, typename = std::enable_if_t<
+        !std::is_same_v<D, InplaceFunction> && std::is_invocable_r_v<R, D &, Args...>>>
+    InplaceFunction(F &&fn); // NOLINT(*-explicit-constructor)
+
+    InplaceFunction(InplaceFunction &&other) noexcept;
+    InplaceFunction &operator=(InplaceFunction &&other) noexcept;
+
+    InplaceFunction(const InplaceFunction &) = delete;
+    InplaceFunction &operator=(const InplaceFunction &) = delete;
+
+    ~InplaceFunction() { reset(); }
+
+    R operator()(Args... args) const;
+
+    void reset();
+
+    explicit operator bool() const { return _vtable != nullptr; }
+    bool operator==(std::nullptr_t) const { return _vtable == nullptr; }
+    bool operator!=(std::nullptr_t) const { return _vtable != nullptr; }
+
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+template<typename R, typename... Args, size_t Capacity>
+template<typename F, typename D, typename>
+InplaceFunction<R(Args...), Capacity>::InplaceFunction(F &&fn) {
+    static_assert(sizeof(D) <= Capacity, "InplaceFunction: callable is too big, increase capacity");
+    static_assert(alignof(D) <= ALIGNMENT, "InplaceFunction: callable alignment isn't supported");
+
+    new(_storage) D(std::forward<F>(fn));
+    _vtable = &VTABLE_FOR<D>;
+}
+
+template<typename R, typename... Args, size_t Capacity>
+InplaceFunction<R(Args...), Capacity>::InplaceFunction(InplaceFunction &&other) noexcept {
+    if (other._vtable == nullptr) return;
+
+    other._vtable->move(_storage, other._storage);
+    _vtable = other._vtable;
+    other._vtable = nullptr;
+}
+
+template<typename R, typename... Args, size_t Capacity>
+InplaceFunction<R(Args...), Capacity> &InplaceFunction<R(Args...), Capacity>::operator=(InplaceFunction &&other) noexcept {
+    if (this == &other) return *this;
+
+    reset();
+    if (other._vtable != nullptr) {
+        other._vtable->move(_storage, other._storage);
+        _vtable = other._vtable;
+        other._vtable = nullptr;
+    }
+
+    return *this;
+}
+
+template<typename R, typename... Args, size_t Capacity>
+R InplaceFunction<R(Args...), Capacity>::operator()(Args... args) const {
+    if (_vtable == nullptr) {
+        D_PRINT("InplaceFunction: Calling empty function");
+        abort();
+    }
+
+    return _vtable->invoke(_storage, std::forward<Args>(args)...);
+}
+
+template<typename R, typename... Args, size_t Capacity>
+void InplaceFunction<R(Args...), Capacity>::reset() {
+    if (_vtable == nullptr) return;
+
+    _vtable->destroy(_storage);
+    _vtable = nullptr;
+}
@@ -7,6 +7,7 @@ Led::Led(uint8_t pin) : _pin(pin) {}
 void Led::begin() {
     pinMode(_pin, OUTPUT);
 
+    _mutex = xSemaphoreCreateMutex();
     _initialized = true;
 }
 
@@ -21,7 +22,14 @@ void Led::_refresh_led(bool active) {
 }
 
 void Led::flash(unsigned long duration) {
-    if (!_initialized || (_active && _blink_count == 0)) return;
+    if (!_initialized) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+
+    if (_active && _blink_count == 0) {
+        xSemaphoreGive(_mutex);
+        return;
+    }
 
     _active = true;
     _start_time = millis();
@@ -33,6 +41,11 @@ void Led::flash(unsigned long duration) {
 
     _refresh_led(true);
 
+    // Endless flash has nothing to animate
+    if (duration > 0) _start_ticking();
+
+    xSemaphoreGive(_mutex);
+
     if (duration > 0) {
         VERBOSE(D_PRINTF("Led: setup flash mode for %i\n", duration));
     } else {
@@ -43,8 +56,10 @@ void Led::flash(unsigned long duration) {
 void Led::blink(uint8_t count, bool continuously) {
     if (!_initialized) return;
 
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+
     if (_active && count == 0) {
-        turn_off();
+        _turn_off();
     } else if (_active && _blink_count > 0) {
         _continuously = continuously;
         _blink_count = count;
@@ -61,22 +76,48 @@ void Led::blink(uint8_t count, bool continuously) {
         _continuously = continuously;
 
         _refresh_led(true);
+        _start_ticking();
 
         VERBOSE(D_PRINTF("Led: setup blink mode, count: %i, %s\n", count, continuously ? "continuously" : "once"));
     }
+
+    xSemaphoreGive(_mutex);
 }
 
 void Led::turn_off() {
-    if (!_initialized || !_active) return;
+    if (!_initialized) return;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _turn_off();
+    xSemaphoreGive(_mutex);
+}
+
+void Led::_turn_off() {
+    if (!_active) return;
 
     _active = false;
     _refresh_led(false);
 
+    _tick_interval.cancel();
+    _tick_interval = {};
+
     VERBOSE(D_PRINT("Led: Turn off"));
 }
 
-void Led::tick() {
-    if (!_initialized || !_active) return;
+void Led::_start_ticking() {
+    if (_tick_interval) return;
+
+    _tick_interval = SystemTimer::set_interval(LED_TICK_INTERVAL, [this] { _tick(); });
+    if (!_tick_interval) D_PRINT("Led: Unable to start tick interval");
+}
+
+void Led::_tick() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+
+    if (!_active) {
+        xSemaphoreGive(_mutex);
+        return;
+    }
 
     auto time = millis();
     auto delta = time - _start_time;
@@ -89,7 +130,7 @@ void Led::tick() {
 
             if (delta - _blink_active_duration > _blink_wait_duration) {
                 _start_time = time;
-                if (--_blink_count_left == 0 && !_continuously) turn_off();
+                if (--_blink_count_left == 0 && !_continuously) _turn_off();
             }
         }
     } else if (_blink_count > 0 && _continuously) {     // Blink Mode Cool down
@@ -99,8 +140,10 @@ void Led::tick() {
             _refresh_led(true);
         }
     } else {    // Flash Mode
-        if (_flash_duration > 0 && delta < _flash_duration) {
-            turn_off();
+        if (_flash_duration > 0 && delta >= _flash_duration) {
+            _turn_off();
         }
     }
+
+    xSemaphoreGive(_mutex);
 }
@@ -2,6 +2,12 @@
 
 #include <Arduino.h>
 
+#include "../async/system_timer.h"
+
+#ifndef LED_TICK_INTERVAL
+#define LED_TICK_INTERVAL                   (10u)
+#endif
+
 class Led {
     uint16_t _max_brightness = 0xff;
     unsigned long _blink_active_duration = 60ul;
@@ -21,10 +27,17 @@ class Led {
 
     unsigned long _start_time = 0;
 
-    void _refresh_led(bool active);
-
     bool _initialized = false;
 
+    // Led is animated by SystemTimer while active, state is changed from other tasks
+    SemaphoreHandle_t _mutex = nullptr;
+    IntervalHandle _tick_interval;
+
+    void _refresh_led(bool active);
+    void _turn_off();
+    void _start_ticking();
+    void _tick();
+
 public:
     explicit Led(uint8_t pin);
 
@@ -37,8 +50,6 @@ public:
 
     void turn_off();
 
-    void tick();
-
     [[nodiscard]] bool initialized() const { return _initialized; }
     [[nodiscard]] bool active() const { return _active; }
     [[nodiscard]] uint8_t blink_count() const { return _blink_count; }
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+/**
+ * Bounded multi-producer/multi-consumer queue with preallocated slots.
+ *
+ * Both sides reserve a slot with a CAS on their position and publish it through the slot sequence number,
+ * so ::push() and ::pop() never allocate and never take a lock.
+ */
+template<typename T, uint32_t Capacity>
+class MpmcQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "MpmcQueue: Capacity must be a power of two");
+
+    static constexpr uint32_t MASK = Capacity - 1;
+
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T value;
+    };
+
+    Cell _cells[Capacity];
+
+    std::atomic<uint32_t> _enqueue_pos {0};
+    std::atomic<uint32_t> _dequeue_pos {0};
+
+public:
+    MpmcQueue();
+
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(MpmcQueue const &) = delete;
+
+    bool push(T &&value);
+    bool pop(T &out);
+
+    [[nodiscard]] uint32_t size() const;
+    [[nodiscard]] bool empty() const { return size() == 0; }
+
+    static constexpr uint32_t capacity() { return Capacity; }
+};
+
+template<typename T, uint32_t Capacity>
+MpmcQueue<T, Capacity>::MpmcQueue() {
+    for (uint32_t i = 0; i < Capacity; ++i) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T, uint32_t Capacity>
+bool MpmcQueue<T, Capacity>::push(T &&value) {
+    uint32_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+    Cell *cell;
+    while (true) {
+        cell = &_cells[pos & MASK];
+
+        const uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = (int32_t) (seq - pos);
+
+        if (diff == 0) {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+template<typename T, uint32_t Capacity>
+bool MpmcQueue<T, Capacity>::pop(T &out) {
+    uint32_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+
+    Cell *cell;
+    while (true) {
+        cell = &_cells[pos & MASK];
+
+        const uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = (int32_t) (seq - (pos + 1));
+
+        if (diff == 0) {
+            if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    out = std::move(cell->value);
+    cell->value = T {};
+
+    cell->sequence.store(pos + Capacity, std::memory_order_release);
+    return true;
+}
+
+template<typename T, uint32_t Capacity>
+uint32_t MpmcQueue<T, Capacity>::size() const {
+    const uint32_t tail = _dequeue_pos.load(std::memory_order_relaxed);
+    const uint32_t head = _enqueue_pos.load(std::memory_order_relaxed);
+
+    return head - tail;
+}
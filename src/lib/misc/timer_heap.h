@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Binary heap of timers with microsecond deadlines. Same interface as TimingWheel, but grows on demand.
+ */
+template<typename T>
+class TimerHeap {
+    struct Entry {
+        uint64_t deadline;
+        uint32_t id;
+        T value;
+
+        bool operator>(const Entry &other) const { return deadline > other.deadline; }
+    };
+
+    std::vector<Entry> _heap;
+    uint32_t _next_id = 0;
+
+public:
+    static constexpr uint32_t INVALID_ID = 0;
+
+    uint32_t push(uint64_t deadline_micros, T &&value);
+    bool pop_expired(uint64_t now_micros, T &out, uint64_t &out_deadline);
+
+    // O(n), cancellation is rare compared to timer expiration
+    bool cancel(uint32_t id, T &out);
+
+    [[nodiscard]] uint64_t next_deadline() const { return _heap.empty() ? UINT64_MAX : _heap.front().deadline; }
+
+    [[nodiscard]] size_t size() const { return _heap.size(); }
+    [[nodiscard]] bool empty() const { return _heap.empty(); }
+};
+
+template<typename T>
+uint32_t TimerHeap<T>::push(uint64_t deadline_micros, T &&value) {
+    if (++_next_id == INVALID_ID) ++_next_id;
+
+    _heap.push_back({.deadline = deadline_micros, .id = _next_id, .value = std::move(value)});
+    std::push_heap(_heap.begin(), _heap.end(), std::greater<>());
+
+    return _next_id;
+}
+
+template<typename T>
+bool TimerHeap<T>::pop_expired(uint64_t now_micros, T &out, uint64_t &out_deadline) {
+    if (_heap.empty() || _heap.front().deadline > now_micros) return false;
+
+    std::pop_heap(_heap.begin(), _heap.end(), std::greater<>());
+
+    auto &entry = _heap.back();
+    out = std::move(entry.value);
+    out_deadline = entry.deadline;
+    _heap.pop_back();
+
+    return true;
+}
+
+template<typename T>
+bool TimerHeap<T>::cancel(uint32_t id, T &out) {
+    auto it = std::find_if(_heap.begin(), _heap.end(), [id](const Entry &entry) { return entry.id == id; });
+    if (it == _heap.end()) return false;
+
+    out = std::move(it->value);
+    _heap.erase(it);
+    std::make_heap(_heap.begin(), _heap.end(), std::greater<>());
+
+    return true;
+}
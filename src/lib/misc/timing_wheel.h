@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Hierarchical timing wheel with preallocated nodes. Pool starts with a single chunk of nodes and takes up to
+ * MaxChunks of them. Chunks are allocated by the caller, so it can do that outside of its lock, see ::add_chunk().
+ *
+ * Deadlines are in microseconds and quantized to ticks of 2^TICK_SHIFT us, timers never fire before their deadline.
+ * Each level has 64 slots; timers from higher levels are cascaded down when the wheel reaches their range.
+ * ::push() is O(1), expiry is O(1) per timer plus O(LEVELS) per occupied slot or cascade boundary.
+ */
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks = 16>
+class TimingWheel {
+    static_assert(ChunkCapacity > 0 && MaxChunks > 0, "TimingWheel: Capacity must be positive");
+    static_assert((uint32_t) ChunkCapacity * MaxChunks < UINT16_MAX, "TimingWheel: Capacity is out of range");
+
+    static constexpr uint8_t TICK_SHIFT = 10;
+    static constexpr uint8_t LEVELS = 4;
+    static constexpr uint8_t SLOT_BITS = 6;
+    static constexpr uint8_t SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t MAX_DISTANCE = (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+    static constexpr uint16_t NIL = UINT16_MAX;
+
+    // Node location, values below LEVELS are wheel levels
+    static constexpr uint8_t EXPIRED = LEVELS;
+    static constexpr uint8_t FREE = UINT8_MAX;
+
+    struct Node {
+        uint64_t deadline = 0;
+        uint16_t next = NIL;
+        uint16_t prev = NIL;
+        uint16_t generation = 0;
+        uint8_t level = FREE;
+        uint8_t slot = 0;
+        T value {};
+    };
+
+    // Nodes never move, so growth doesn't copy timers
+    std::unique_ptr<Node[]> _chunks[MaxChunks];
+    uint8_t _chunk_count = 0;
+    // Nodes below are in use or in the free list, the rest of chunks are untouched
+    uint16_t _fresh = 0;
+    uint16_t _free = NIL;
+
+    uint16_t _slots[LEVELS][SLOTS];
+    uint64_t _occupied[LEVELS] {};
+    uint16_t _expired = NIL;
+
+    uint64_t _current_tick = 0;
+    uint16_t _size = 0;
+
+public:
+    // Returned by ::push() on failure, never matches a timer
+    static constexpr uint32_t INVALID_ID = 0;
+
+    typedef std::unique_ptr<Node[]> Chunk;
+
+    TimingWheel();
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(TimingWheel const &) = delete;
+
+    // Returns id of the timer or INVALID_ID when pool is exhausted, value is left untouched then
+    uint32_t push(uint64_t deadline_micros, T &&value);
+    bool pop_expired(uint64_t now_micros, T &out, uint64_t &out_deadline);
+
+    // Removes pending timer, value is moved to out. Ids of fired or cancelled timers are ignored
+    bool cancel(uint32_t id, T &out);
+
+    // Lower bound of the earliest deadline, UINT64_MAX when empty
+    [[nodiscard]] uint64_t next_deadline() const;
+
+    [[nodiscard]] uint16_t size() const { return _size; }
+    [[nodiscard]] bool empty() const { return _size == 0; }
+
+    [[nodiscard]] uint16_t capacity() const { return _chunk_count * ChunkCapacity; }
+
+    [[nodiscard]] bool full() const { return _free == NIL && _fresh == capacity(); }
+    [[nodiscard]] bool can_grow() const { return _chunk_count < MaxChunks; }
+
+    static Chunk allocate_chunk() { return Chunk(new Node[ChunkCapacity]); }
+
+    // O(1), so it fits a critical section. Returns false if pool can't grow anymore, chunk is left to the caller then
+    bool add_chunk(Chunk &chunk);
+
+private:
+    static uint64_t tick_of(uint64_t deadline_micros) { return (deadline_micros + (1u << TICK_SHIFT) - 1) >> TICK_SHIFT; }
+
+    void _insert(uint16_t index);
+    void _advance(uint64_t target_tick);
+    void _cascade(uint8_t level);
+    [[nodiscard]] uint64_t _next_event_tick() const;
+
+    Node &_node(uint16_t index) { return _chunks[index / ChunkCapacity][index % ChunkCapacity]; }
+    const Node &_node(uint16_t index) const { return _chunks[index / ChunkCapacity][index % ChunkCapacity]; }
+
+    void _release(uint16_t index, T &out);
+
+    uint16_t &_head_of(const Node &node) { return node.level == EXPIRED ? _expired : _slots[node.level][node.slot]; }
+
+    void _link(uint16_t &head, uint16_t index);
+    void _unlink(uint16_t &head, uint16_t index);
+};
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+TimingWheel<T, ChunkCapacity, MaxChunks>::TimingWheel() {
+    _chunks[_chunk_count++] = allocate_chunk();
+    for (auto &level: _slots) for (auto &slot: level) slot = NIL;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+uint32_t TimingWheel<T, ChunkCapacity, MaxChunks>::push(uint64_t deadline_micros, T &&value) {
+    uint16_t index;
+    if (_free != NIL) {
+        index = _free;
+        _free = _node(index).next;
+    } else if (_fresh < capacity()) {
+        index = _fresh++;
+    } else {
+        return INVALID_ID;
+    }
+
+    auto &node = _node(index);
+
+    if (++node.generation == 0) node.generation = 1;
+    node.deadline = deadline_micros;
+    node.value = std::move(value);
+
+    _insert(index);
+    ++_size;
+
+    return ((uint32_t) node.generation << 16) | index;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+bool TimingWheel<T, ChunkCapacity, MaxChunks>::pop_expired(uint64_t now_micros, T &out, uint64_t &out_deadline) {
+    if (_expired == NIL) _advance(now_micros >> TICK_SHIFT);
+    if (_expired == NIL) return false;
+
+    const auto index = _expired;
+    out_deadline = _node(index).deadline;
+
+    _unlink(_expired, index);
+    _release(index, out);
+
+    return true;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+bool TimingWheel<T, ChunkCapacity, MaxChunks>::cancel(uint32_t id, T &out) {
+    const auto index = (uint16_t) (id & 0xffff);
+    if (index >= _fresh) return false;
+
+    auto &node = _node(index);
+    if (node.level == FREE || node.generation != (uint16_t) (id >> 16)) return false;
+
+    auto &head = _head_of(node);
+    _unlink(head, index);
+
+    if (node.level != EXPIRED && head == NIL) _occupied[node.level] &= ~(1ull << node.slot);
+
+    _release(index, out);
+    return true;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+bool TimingWheel<T, ChunkCapacity, MaxChunks>::add_chunk(Chunk &chunk) {
+    if (!chunk || !can_grow()) return false;
+
+    // Nodes of the chunk are taken in order by ::push(), so the free list isn't touched
+    _chunks[_chunk_count++] = std::move(chunk);
+    return true;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_release(uint16_t index, T &out) {
+    auto &node = _node(index);
+
+    out = std::move(node.value);
+    node.value = T {};
+    node.level = FREE;
+
+    node.next = _free;
+    _free = index;
+    --_size;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+uint64_t TimingWheel<T, ChunkCapacity, MaxChunks>::next_deadline() const {
+    if (_expired != NIL) return 0;
+
+    const auto tick = _next_event_tick();
+    return tick != UINT64_MAX ? tick << TICK_SHIFT : UINT64_MAX;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_insert(uint16_t index) {
+    auto &node = _node(index);
+
+    const auto tick = tick_of(node.deadline);
+    if (tick <= _current_tick) {
+        node.level = EXPIRED;
+        _link(_expired, index);
+        return;
+    }
+
+    // Timers beyond the wheel range wait in the farthest slot and get re-inserted on cascade
+    const auto distance = tick - _current_tick;
+    const auto placement = distance <= MAX_DISTANCE ? tick : _current_tick + MAX_DISTANCE;
+
+    uint8_t level = 0;
+    while (level < LEVELS - 1 && distance >> (SLOT_BITS * (level + 1))) ++level;
+
+    const auto slot = (uint8_t) ((placement >> (SLOT_BITS * level)) & (SLOTS - 1));
+    node.level = level;
+    node.slot = slot;
+
+    _link(_slots[level][slot], index);
+    _occupied[level] |= 1ull << slot;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_advance(uint64_t target_tick) {
+    while (_current_tick < target_tick) {
+        const auto next = _next_event_tick();
+        if (next > target_tick) {
+            // Nothing happens in between, so skip the whole interval
+            _current_tick = target_tick;
+            return;
+        }
+
+        _current_tick = next;
+
+        for (uint8_t level = 1; level < LEVELS; ++level) {
+            if (_current_tick & ((1ull << (SLOT_BITS * level)) - 1)) break;
+            _cascade(level);
+        }
+
+        _cascade(0);
+    }
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_cascade(uint8_t level) {
+    const auto slot = (uint8_t) ((_current_tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+    if (!(_occupied[level] & (1ull << slot))) return;
+
+    auto &head = _slots[level][slot];
+    _occupied[level] &= ~(1ull << slot);
+
+    while (head != NIL) {
+        const auto index = head;
+        _unlink(head, index);
+        _insert(index);
+    }
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+uint64_t TimingWheel<T, ChunkCapacity, MaxChunks>::_next_event_tick() const {
+    uint64_t result = UINT64_MAX;
+
+    for (uint8_t level = 0; level < LEVELS; ++level) {
+        const auto bitmap = _occupied[level];
+        if (!bitmap) continue;
+
+        // Slot of the next level boundary: the closest occupied one strictly after current position
+        const auto base = _current_tick >> (SLOT_BITS * level);
+        const auto shift = (uint8_t) ((base + 1) & (SLOTS - 1));
+        const auto rotated = shift ? (bitmap >> shift) | (bitmap << (SLOTS - shift)) : bitmap;
+
+        const auto tick = (base + 1 + __builtin_ctzll(rotated)) << (SLOT_BITS * level);
+        if (tick < result) result = tick;
+    }
+
+    return result;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_link(uint16_t &head, uint16_t index) {
+    auto &node = _node(index);
+
+    // Circular list: head's prev is the tail, so timers of one slot keep insertion order
+    if (head == NIL) {
+        node.next = node.prev = index;
+        head = index;
+        return;
+    }
+
+    auto &first = _node(head);
+    node.next = head;
+    node.prev = first.prev;
+    _node(first.prev).next = index;
+    first.prev = index;
+}
+
+template<typename T, uint16_t ChunkCapacity, uint8_t MaxChunks>
+void TimingWheel<T, ChunkCapacity, MaxChunks>::_unlink(uint16_t &head, uint16_t index) {
+    auto &node = _node(index);
+
+    if (node.next == index) {
+        head = NIL;
+    } else {
+        _node(node.prev).next = node.next;
+        _node(node.next).prev = node.prev;
+        if (head == index) head = node.next;
+    }
+
+    node.next = node.prev = NIL;
+}
@@ -19,6 +19,12 @@ bool AsyncEspNow::begin() {
         return false;
     }
 
+    if (_send_mutex == nullptr) _send_mutex = xSemaphoreCreateMutex();
+    if (_send_mutex == nullptr) {
+        D_PRINT("AsyncEspNow: Unable to create mutex");
+        return false;
+    }
+
     if (WiFiClass::getMode() == WIFI_MODE_NULL) WiFiClass::mode(WIFI_MODE_STA);
 
     auto ret = esp_now_init();
@@ -37,6 +43,8 @@ bool AsyncEspNow::begin() {
         return false;
     }
 
+    _packets.open();
+
     _initialized = true;
     return true;
 }
@@ -44,9 +52,21 @@ bool AsyncEspNow::begin() {
 void AsyncEspNow::end() {
     if (!_initialized) return;
 
-    set_on_packet_cb(nullptr);
+    _packets.close();
     _initialized = false;
 
+    // Delivery reports won't come anymore
+    std::vector<InFlightFrame> in_flight;
+
+    xSemaphoreTake(_send_mutex, portMAX_DELAY);
+    for (auto &[_, peer]: _peer_sends) {
+        for (auto &frame: peer.in_flight) in_flight.push_back(std::move(frame));
+        peer.in_flight.clear();
+    }
+    xSemaphoreGive(_send_mutex);
+
+    for (auto &frame: in_flight) frame.promise->set_error();
+
     esp_now_deinit();
 }
 
@@ -56,6 +76,11 @@ Future<void> AsyncEspNow::send(const uint8_t *mac_addr, const uint8_t *data, uin
         return Future<void>::errored();
     }
 
+    if (size > ESP_NOW_MAX_DATA_LEN) {
+        D_PRINTF("AsyncEspNow: Packet is too big: %i\r\n", size);
+        return Future<void>::errored();
+    }
+
     if (!register_peer(mac_addr)) {
         D_PRINT("AsyncEspNow: Failed to register peer");
         return Future<void>::errored();
@@ -66,16 +91,36 @@ Future<void> AsyncEspNow::send(const uint8_t *mac_addr, const uint8_t *data, uin
     D_PRINT_HEX(mac_addr, ESP_NOW_ETH_ALEN);
     D_PRINTF("\t- Size: %i\r\n", size);
 
-    auto promise = std::make_shared<Promise<void>>();
-
     auto send_key = mac_to_key(mac_addr);
-    _send_order[send_key].push(promise);
+    auto &peer = _peer_sends_of(send_key);
+
+    // Keep delivery reports of one peer on one worker, so they are handled in send order
+    auto promise = Promise<void>::create();
+    promise->set_priority(Dispatcher::Priority::URGENT);
+    promise->set_worker(Dispatcher::worker_for(send_key));
+
+    // Peer permit first, so frames of a busy peer don't hold global permits while waiting for their own
+    auto peer_permit = peer.limit.try_acquire();
+    if (peer_permit) {
+        if (auto permit = _in_flight.try_acquire()) {
+            _send_frame(send_key, data, size, promise, std::move(peer_permit), std::move(permit));
+            return Future {promise};
+        }
+    }
 
-    if (esp_now_send(mac_addr, data, size) != ESP_OK) {
-        D_PRINT("AsyncEspNow: Failed to register peer");
+    VERBOSE(D_PRINT("AsyncEspNow: Too many packets in flight. Waiting for permit"));
 
-        _send_order[send_key].pop();
-        promise->set_error();
+    auto frame = std::make_shared<PendingFrame>();
+    frame->key = send_key;
+    frame->promise = promise;
+    frame->peer_permit = std::move(peer_permit);
+    frame->size = size;
+    memcpy(frame->data, data, size);
+
+    if (frame->peer_permit) {
+        _acquire_permit(frame);
+    } else {
+        _acquire_peer_permit(peer, frame);
     }
 
     return Future {promise};
@@ -103,8 +148,7 @@ bool AsyncEspNow::register_peer(const uint8_t *mac_addr, uint8_t channel) {
     D_WRITE("AsyncEspNow: Register new peer ");
     D_PRINT_HEX(mac_addr, ESP_NOW_ETH_ALEN);
 
-    uint64_t mac_addr_key = mac_to_key(mac_addr);
-    _send_order[mac_addr_key] = {};
+    _peer_sends_of(mac_to_key(mac_addr));
     _peers.push_back(peer);
 
     return true;
@@ -136,22 +180,134 @@ bool AsyncEspNow::change_channel(uint8_t channel) { // NOLINT(*-make-member-func
     return success;
 }
 
+AsyncEspNow::PeerSends &AsyncEspNow::_peer_sends_of(uint64_t key) {
+    xSemaphoreTake(_send_mutex, portMAX_DELAY);
+    auto &result = _peer_sends.try_emplace(key, Dispatcher::worker_for(key)).first->second;
+    xSemaphoreGive(_send_mutex);
+
+    return result;
+}
+
+void AsyncEspNow::_acquire_peer_permit(PeerSends &peer, const std::shared_ptr<PendingFrame> &frame) {
+    auto future = peer.limit.acquire();
+    future.on_finished([this, frame, future](bool success) {
+        if (!success) return frame->promise->set_error();
+
+        frame->peer_permit = future.consume();
+        _acquire_permit(frame);
+    });
+}
+
+void AsyncEspNow::_acquire_permit(const std::shared_ptr<PendingFrame> &frame) {
+    auto future = _in_flight.acquire();
+    future.on_finished([this, frame, future](bool success) {
+        if (!success) return frame->promise->set_error();
+
+        frame->permit = future.consume();
+
+        // Global permit may come on any worker, frame goes out on the worker of its peer
+        const bool dispatched = Dispatcher::dispatch_inline([this, frame] {
+            _send_frame(frame->key, frame->data, frame->size, frame->promise,
+                std::move(frame->peer_permit), std::move(frame->permit));
+        }, Dispatcher::Priority::URGENT, Dispatcher::worker_for(frame->key));
+
+        if (!dispatched) frame->promise->set_error();
+    });
+}
+
+void AsyncEspNow::_send_frame(
+    uint64_t key, const uint8_t *data, uint8_t size, const std::shared_ptr<Promise<void>> &promise,
+    AsyncSemaphore::Permit peer_permit, AsyncSemaphore::Permit permit
+) {
+    // Cancelled while waiting for permits, permits go to the next frames
+    if (promise->finished()) return;
+
+    if (!_initialized) {
+        D_PRINT("AsyncEspNow: Not initialized");
+        return promise->set_error();
+    }
+
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    memcpy(mac_addr, &key, ESP_NOW_ETH_ALEN);
+
+    // Permits go back only after the failed frame leaves the queue and the mutex
+    InFlightFrame failed_frame;
+
+    xSemaphoreTake(_send_mutex, portMAX_DELAY);
+
+    auto &in_flight = _peer_sends.try_emplace(key, Dispatcher::worker_for(key)).first->second.in_flight;
+    in_flight.push_back({promise, std::move(peer_permit), std::move(permit)});
+
+    auto ret = esp_now_send(mac_addr, data, size);
+    if (ret != ESP_OK) {
+        failed_frame = std::move(in_flight.back());
+        in_flight.pop_back();
+    }
+
+    xSemaphoreGive(_send_mutex);
+
+    if (ret != ESP_OK) {
+        D_PRINTF("AsyncEspNow: Failed to send packet: %i\r\n", ret);
+        promise->set_error();
+    }
+}
+
 void AsyncEspNow::_on_sent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+    SentEvent event {.status = (uint8_t) status};
+    memcpy(event.mac_addr, mac_addr, ESP_NOW_ETH_ALEN);
+
+    // Keep WiFi task short: hand the report off to dispatcher without allocations
+    if (Dispatcher::dispatch_from_isr(_on_sent_event, event)) return;
+
+    // WiFi task never waits for the send mutex: its holder may be inside esp_now_send(), waiting for this very task
     auto &self = instance();
+    if (self._process_sent(mac_addr, status, 0)) return;
+
+    VERBOSE(D_PRINT("AsyncEspNow: Event pool is full and send mutex is busy. Deferring sent event"));
+    if (Dispatcher::dispatch([event] {
+        instance()._process_sent(event.mac_addr, (esp_now_send_status_t) event.status);
+    }, Dispatcher::Priority::URGENT)) return;
 
+    self._dropped_sent_events.fetch_add(1, std::memory_order_relaxed);
+
+    D_WRITE("AsyncEspNow: Dispatcher is full. Dropping sent event. Destination: ");
+    D_PRINT_HEX(mac_addr, ESP_NOW_ETH_ALEN);
+}
+
+void AsyncEspNow::_on_sent_event(const DispatcherIsrEvent &event) {
+    const auto sent = event.payload_as<SentEvent>();
+    instance()._process_sent(sent.mac_addr, (esp_now_send_status_t) sent.status);
+}
+
+bool AsyncEspNow::_process_sent(const uint8_t *mac_addr, esp_now_send_status_t status, TickType_t wait_ticks) {
     uint64_t mac_addr_key = mac_to_key(mac_addr);
-    auto it = self._send_order.find(mac_addr_key);
-    if (it == self._send_order.end() || it->second.empty()) {
+
+    InFlightFrame frame;
+    if (xSemaphoreTake(_send_mutex, wait_ticks) != pdTRUE) return false;
+
+    auto it = _peer_sends.find(mac_addr_key);
+    const bool found = it != _peer_sends.end() && !it->second.in_flight.empty();
+    if (found) {
+        frame = std::move(it->second.in_flight.front());
+        it->second.in_flight.pop_front();
+    }
+
+    xSemaphoreGive(_send_mutex);
+
+    if (!found) {
         D_WRITE("AsyncEspNow: Unexpected sent event. Destination: ");
         D_PRINT_HEX(mac_addr, ESP_NOW_ETH_ALEN);
-        return;
+        return true;
     }
 
     VERBOSE(D_PRINT("AsyncEspNow: Received sent event"));
 
-    auto &queue = it->second;
-    const auto promise = queue.front();
-    queue.pop();
+    // Released permit may send the next frame in place, so not under the mutex.
+    // And before resolution, so continuation of the promise can send right away
+    frame.peer_permit.release();
+    frame.permit.release();
+
+    const auto &promise = frame.promise;
 
     if (status == ESP_NOW_SEND_SUCCESS) {
         VERBOSE(D_WRITE("AsyncEspNow: Send confirmed "));
@@ -164,6 +320,8 @@ void AsyncEspNow::_on_sent(const uint8_t *mac_addr, esp_now_send_status_t status
 
         promise->set_error();
     }
+
+    return true;
 }
 
 void AsyncEspNow::_on_receive(const uint8_t *mac_addr, const uint8_t *data, int data_len) {
@@ -181,8 +339,5 @@ void AsyncEspNow::_on_receive(const uint8_t *mac_addr, const uint8_t *data, int
     VERBOSE(D_WRITE("\t- Data: "));
     VERBOSE(D_PRINT_HEX(data, data_len));
 
-    auto &self = instance();
-    if (self._on_packet_cb) {
-        self._on_packet_cb(std::move(packet));
-    }
+    if (!instance()._packets.push(std::move(packet))) D_PRINT("AsyncEspNow: Packet dropped");
 }
@@ -1,30 +1,84 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <esp_now.h>
-#include <queue>
 #include <unordered_map>
 #include <WiFi.h>
 
+#include <lib/async/async_semaphore.h>
+#include <lib/async/async_stream.h>
 #include <lib/async/promise.h>
 #include <lib/debug.h>
 
+// Received packets waiting for AsyncEspNowInteraction. Oldest ones are dropped on overflow, WiFi task never waits
+#ifndef ASYNC_ESP_NOW_RX_QUEUE_SIZE
+#define ASYNC_ESP_NOW_RX_QUEUE_SIZE                         (16u)
+#endif
+
+// Frames handed to ESP-NOW and waiting for delivery report. Exceeding ESP-NOW buffers ends up in ESP_ERR_ESPNOW_NO_MEM
+#ifndef ASYNC_ESP_NOW_MAX_IN_FLIGHT
+#define ASYNC_ESP_NOW_MAX_IN_FLIGHT                         (8u)
+#endif
+
+// Limit for a single peer, so one busy peer can't take all in-flight slots
+#ifndef ASYNC_ESP_NOW_MAX_IN_FLIGHT_PER_PEER
+#define ASYNC_ESP_NOW_MAX_IN_FLIGHT_PER_PEER                (2u)
+#endif
+
 struct EspNowPacket {
     uint8_t mac_addr[6];
     uint8_t size;
     std::shared_ptr<uint8_t[]> data;
 };
 
-typedef std::function<void(EspNowPacket packet)> AsyncEspNowOnPacketCb;
+typedef AsyncStream<EspNowPacket, ASYNC_ESP_NOW_RX_QUEUE_SIZE> EspNowPacketStream;
 
 class AsyncEspNow {
+    struct SentEvent {
+        uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+        uint8_t status;
+    };
+
+    struct InFlightFrame {
+        std::shared_ptr<Promise<void>> promise;
+        AsyncSemaphore::Permit peer_permit;
+        AsyncSemaphore::Permit permit;
+    };
+
+    struct PeerSends {
+        AsyncSemaphore limit;
+
+        // Delivery reports come in send order
+        std::deque<InFlightFrame> in_flight;
+
+        explicit PeerSends(uint8_t worker) :
+            limit(ASYNC_ESP_NOW_MAX_IN_FLIGHT_PER_PEER, Dispatcher::Priority::URGENT, worker) {}
+    };
+
+    // Copy of the frame waiting for permits
+    struct PendingFrame {
+        uint64_t key;
+        std::shared_ptr<Promise<void>> promise;
+        AsyncSemaphore::Permit peer_permit;
+        AsyncSemaphore::Permit permit;
+        uint8_t size;
+        uint8_t data[ESP_NOW_MAX_DATA_LEN];
+    };
+
     static AsyncEspNow _instance;
 
     bool _initialized = false;
 
     std::vector<esp_now_peer_info> _peers;
-    std::unordered_map<uint64_t, std::queue<std::shared_ptr<Promise<void>>>> _send_order;
+    // Guards peers map and in-flight queues. Held across esp_now_send(), so queue order matches delivery reports
+    SemaphoreHandle_t _send_mutex = nullptr;
+    std::unordered_map<uint64_t, PeerSends> _peer_sends;
+    AsyncSemaphore _in_flight {ASYNC_ESP_NOW_MAX_IN_FLIGHT, Dispatcher::Priority::URGENT};
+
+    std::atomic<uint32_t> _dropped_sent_events {0};
 
-    AsyncEspNowOnPacketCb _on_packet_cb {};
+    EspNowPacketStream _packets {StreamOverflow::DROP_OLDEST};
 
     AsyncEspNow() = default;
 
@@ -37,6 +91,7 @@ public:
     bool begin();
     void end();
 
+    // Frame goes out once in-flight limits allow it, the future resolves with delivery report
     Future<void> send(const uint8_t *mac_addr, const uint8_t *data, uint8_t size);
 
     bool change_channel(uint8_t channel);
@@ -45,9 +100,24 @@ public:
     bool register_peer(const uint8_t *mac_addr, uint8_t channel = 0);
     bool unregister_peer(const uint8_t *mac_addr);
 
-    void set_on_packet_cb(AsyncEspNowOnPacketCb cb) { _on_packet_cb = std::move(cb); }
+    EspNowPacketStream &packets() { return _packets; }
+
+    [[nodiscard]] AsyncSemaphoreStats in_flight_stats() const { return _in_flight.stats(); }
+
+    // Delivery reports lost because dispatcher was overloaded. Their frames stay in flight until end()
+    [[nodiscard]] uint32_t dropped_sent_events() const { return _dropped_sent_events.load(std::memory_order_relaxed); }
 
 private:
+    PeerSends &_peer_sends_of(uint64_t key);
+
+    void _acquire_peer_permit(PeerSends &peer, const std::shared_ptr<PendingFrame> &frame);
+    void _acquire_permit(const std::shared_ptr<PendingFrame> &frame);
+    void _send_frame(uint64_t key, const uint8_t *data, uint8_t size, const std::shared_ptr<Promise<void>> &promise,
+        AsyncSemaphore::Permit peer_permit, AsyncSemaphore::Permit permit);
+
     static void _on_sent(const uint8_t *mac_addr, esp_now_send_status_t status);
+    static void _on_sent_event(const DispatcherIsrEvent &event);
+    // Returns false if send mutex wasn't acquired within wait_ticks
+    bool _process_sent(const uint8_t *mac_addr, esp_now_send_status_t status, TickType_t wait_ticks = portMAX_DELAY);
     static void _on_receive(const uint8_t *mac_addr, const uint8_t *data, int data_len);
 };
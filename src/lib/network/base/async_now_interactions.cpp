@@ -6,10 +6,17 @@ const uint8_t AsyncEspNowInteraction::BROADCAST_MAC[6] = {0xff, 0xff, 0xff, 0xff
 bool AsyncEspNowInteraction::begin() {
     if (_initialized) return false;
 
+    if (_requests_mutex == nullptr) _requests_mutex = xSemaphoreCreateMutex();
+    if (_requests_mutex == nullptr) {
+        D_PRINT("EspNowInteraction: Unable to create mutex");
+        return false;
+    }
+
     auto ok = _async_now.begin();
     if (!ok) return false;
 
-    _async_now.set_on_packet_cb([this](auto packet) { _on_packet_received(std::move(packet)); });
+    _message_stream.open();
+    _receive_packets();
 
     _initialized = true;
     return true;
@@ -18,7 +25,7 @@ bool AsyncEspNowInteraction::begin() {
 void AsyncEspNowInteraction::end() {
     if (!_initialized) return;
 
-    set_on_message_cb(nullptr);
+    _message_stream.close();
     _initialized = false;
 
     _async_now.end();
@@ -121,30 +128,52 @@ Future<EspNowSendResponse> AsyncEspNowInteraction::_send_impl(
 }
 
 Future<EspNowMessage> AsyncEspNowInteraction::_request_impl(uint8_t id, const uint8_t *mac_addr, const uint8_t *data, uint16_t size) {
-    if (auto it = _requests.find(id); it != _requests.end()) {
-        D_PRINTF("EspNowInteraction: request %i already exist. Cancelling...\r\n", id);
+    auto promise = Promise<EspNowMessage>::create();
+    promise->set_priority(Dispatcher::Priority::URGENT);
+
+    // Resolved outside of the lock: its cancel handler takes the lock too
+    std::shared_ptr<Promise<EspNowMessage>> existing_promise;
 
-        // Acquire shared pointer to avoid destruction right after ::erase()
-        auto existing_promise = it->second;
+    xSemaphoreTake(_requests_mutex, portMAX_DELAY);
+    if (auto it = _requests.find(id); it != _requests.end()) {
+        existing_promise = std::move(it->second);
         _requests.erase(it);
+    }
 
+    _requests[id] = promise;
+    xSemaphoreGive(_requests_mutex);
+
+    if (existing_promise) {
+        D_PRINTF("EspNowInteraction: request %i already exist. Cancelling...\r\n", id);
         existing_promise->set_error();
     }
 
-    auto promise = Promise<EspNowMessage>::create();
-    _requests[id] = promise;
+    // Cancelled request stops waiting for response
+    promise->set_cancel_handler([this, id, raw_promise = promise.get()] { _erase_request(id, raw_promise); });
 
     auto send_future = _send_impl(id, false, mac_addr, data, size);
-    return send_future.then<EspNowMessage>([this, promise = std::move(promise)](const auto &future) {
-        auto response = future.result();
+    return send_future.then<EspNowMessage>([this, promise](const auto &future) {
+        const auto &response = future.result_ref();
         VERBOSE(D_PRINTF("EspNowInteraction: request %i sent. Waiting for response...\r\n", response.id));
         return Future {promise};
-    }).on_error([this, id](auto future) {
-        _requests.erase(id);
+    }).on_error([this, id, raw_promise = promise.get()](auto future) {
+        _erase_request(id, raw_promise);
         return future;
     });
 }
 
+void AsyncEspNowInteraction::_erase_request(uint8_t id, const PromiseBase *promise) {
+    // Erased promise may be the last reference, so it is destroyed outside of the lock
+    std::shared_ptr<Promise<EspNowMessage>> erased;
+
+    xSemaphoreTake(_requests_mutex, portMAX_DELAY);
+    if (auto it = _requests.find(id); it != _requests.end() && it->second.get() == promise) {
+        erased = std::move(it->second);
+        _requests.erase(it);
+    }
+    xSemaphoreGive(_requests_mutex);
+}
+
 Future<uint8_t> AsyncEspNowInteraction::_configure_peer_channel(const uint8_t *mac_addr, uint8_t channel) {
     if (channel > 14 || !_async_now.change_channel(channel)) return Future<uint8_t>::errored();
 
@@ -161,6 +190,18 @@ Future<uint8_t> AsyncEspNowInteraction::_configure_peer_channel(const uint8_t *m
            });
 }
 
+void AsyncEspNowInteraction::_receive_packets() {
+    auto packet_future = _async_now.packets().next();
+
+    // Loop ends when AsyncEspNow closes the stream
+    packet_future.on_finished([this, packet_future](bool success) {
+        if (!success) return;
+
+        _on_packet_received(packet_future.take());
+        _receive_packets();
+    });
+}
+
 void AsyncEspNowInteraction::_on_packet_received(EspNowPacket packet) {
     if (packet.size < sizeof(EspNowInteractionPacketHeader)) {
         D_PRINT("EspNowInteraction: received message is too small");
@@ -213,22 +254,25 @@ void AsyncEspNowInteraction::_on_packet_received(EspNowPacket packet) {
     if (message.received_count != message.parts_count) return;
 
     //TODO: unique request_id for each peer?
-    if (auto it = _requests.find(header->id); header->is_response && it != _requests.end()) {
-        D_PRINTF("EspNowInteraction: received message response id %i\r\n", message.id);
-
-        // Acquire shared pointer to avoid destruction right after ::erase()
-        auto promise = std::move(it->second);
-        _requests.erase(it);
+    std::shared_ptr<Promise<EspNowMessage>> request_promise;
+    if (header->is_response) {
+        xSemaphoreTake(_requests_mutex, portMAX_DELAY);
+        if (auto it = _requests.find(header->id); it != _requests.end()) {
+            request_promise = std::move(it->second);
+            _requests.erase(it);
+        }
+        xSemaphoreGive(_requests_mutex);
+    }
 
-        promise->set_success(message);
+    if (request_promise) {
+        D_PRINTF("EspNowInteraction: received message response id %i\r\n", message.id);
+        request_promise->set_success(message);
     } else if (header->is_response) {
         D_PRINTF("EspNowInteraction: received unexpected response id %i\r\n", message.id);
     } else {
         D_PRINTF("EspNowInteraction: received message id %i, size %i\r\n", message.id, message.size);
 
-        if (_on_message_cb) {
-            _on_message_cb(message);
-        }
+        if (!_message_stream.push(message)) D_PRINT("EspNowInteraction: Message dropped");
     }
 
     _messages.erase(message_key.u64);
@@ -2,6 +2,11 @@
 
 #include "async_now.h"
 
+// Assembled messages waiting for a consumer, NowIo on the button side
+#ifndef ASYNC_ESP_NOW_MESSAGE_QUEUE_SIZE
+#define ASYNC_ESP_NOW_MESSAGE_QUEUE_SIZE                    (8u)
+#endif
+
 struct __attribute__((__packed__)) EspNowInteractionPacketHeader {
     uint8_t id;
     bool is_response;
@@ -38,6 +43,8 @@ constexpr uint8_t ESP_NOW_INTERACTION_PACKET_HEADER_LENGTH = sizeof(EspNowIntera
 constexpr uint8_t ESP_NOW_INTERACTION_MAX_PACKET_DATA_LENGTH = ESP_NOW_MAX_DATA_LEN - ESP_NOW_INTERACTION_PACKET_HEADER_LENGTH;
 constexpr uint16_t ESP_NOW_INTERACTION_MAX_DATA_LENGTH = 0xff * ESP_NOW_INTERACTION_MAX_PACKET_DATA_LENGTH;
 
+typedef AsyncStream<EspNowMessage, ASYNC_ESP_NOW_MESSAGE_QUEUE_SIZE> EspNowMessageStream;
+
 class AsyncEspNowInteraction {
     static AsyncEspNowInteraction _instance;
 
@@ -45,10 +52,12 @@ class AsyncEspNowInteraction {
     AsyncEspNow &_async_now = AsyncEspNow::instance();
     uint8_t _id = 0;
 
+    // Requests are started by any task, answered on dispatcher and cancelled by timer task on deadline
+    SemaphoreHandle_t _requests_mutex = nullptr;
     std::unordered_map<uint8_t, std::shared_ptr<Promise<EspNowMessage>>> _requests;
     std::unordered_map<uint64_t, EspNowMessage> _messages;
 
-    std::function<void(EspNowMessage)> _on_message_cb;
+    EspNowMessageStream _message_stream {StreamOverflow::DROP_OLDEST};
 
     AsyncEspNowInteraction() = default;
 
@@ -77,7 +86,8 @@ public:
     Future<void> respond(uint8_t id, const uint8_t *mac_addr, const char *str);
     Future<void> respond(uint8_t id, const uint8_t *mac_addr, const uint8_t *data, uint16_t size);
 
-    void set_on_message_cb(std::function<void(EspNowMessage)> cb) { _on_message_cb = std::move(cb); }
+    // Incoming messages which aren't responses to own requests
+    EspNowMessageStream &messages() { return _message_stream; }
 
     Future<uint8_t> discover_peer_channel(const uint8_t *mac_addr);
 
@@ -87,8 +97,13 @@ private:
     Future<EspNowSendResponse> _send_impl(uint8_t id, bool is_response, const uint8_t *mac_addr, const uint8_t *data, uint16_t size);
     Future<EspNowMessage> _request_impl(uint8_t id, const uint8_t *mac_addr, const uint8_t *data, uint16_t size);
 
+    // Erases request only if its slot still belongs to the promise, id may be reused by a newer request
+    void _erase_request(uint8_t id, const PromiseBase *promise);
+
     Future<uint8_t> _configure_peer_channel(const uint8_t *mac_addr, uint8_t channel);
 
+    // Packets are assembled on dispatcher, so bursts don't hold WiFi task
+    void _receive_packets();
     void _on_packet_received(EspNowPacket packet);
 };
 
@@ -25,6 +25,18 @@ void MqttServer::begin(const char *host, uint16_t port, const char *user, const
     _mqtt_client.setCredentials(user, password);
 
     _connect();
+
+    _connection_interval = SystemTimer::set_interval(MQTT_CONNECTION_CHECK_INTERVAL, [this] {
+        if (_check_pending.exchange(true)) return;
+
+        const bool queued = LoopExecutor::instance().execute([this] {
+            _check_pending = false;
+            handle_connection();
+        }, Dispatcher::Priority::NORMAL);
+
+        // Next tick tries again
+        if (!queued) _check_pending = false;
+    }, 100);
 }
 
 void MqttServer::handle_connection() {
@@ -53,8 +65,8 @@ void MqttServer::_connect() {
 }
 
 void MqttServer::_change_state(MqttServerState state) {
-    _state = state;
     _state_change_time = millis();
+    _state = state;
 }
 
 void MqttServer::_on_connect(bool) {
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <AsyncMqttClient.h>
+#include <atomic>
 #include <map>
 #include <type_traits>
 
 #include "../debug.h"
+#include "../async/executor.h"
+#include "../async/system_timer.h"
 
 #ifndef MQTT_CONNECTION_TIMEOUT
 #define MQTT_CONNECTION_TIMEOUT                 (15000u)
@@ -14,6 +17,10 @@
 #define MQTT_RECONNECT_TIMEOUT                  (5000u)
 #endif
 
+#ifndef MQTT_CONNECTION_CHECK_INTERVAL
+#define MQTT_CONNECTION_CHECK_INTERVAL          (500u)
+#endif
+
 enum class MqttServerState : uint8_t {
     UNINITIALIZED,
     CONNECTING,
@@ -33,6 +40,8 @@ public:
 
     void set_prefix(String str);
 
+    // Connection is supervised by SystemTimer interval. AsyncMqttClient is for Arduino task only,
+    // so checks are handed to LoopExecutor and loop() must call LoopExecutor::run()
     void begin(const char *host, uint16_t port, const char *user, const char *password);
     void handle_connection();
 
@@ -46,9 +55,14 @@ public:
 private:
     AsyncMqttClient _mqtt_client;
 
-    MqttServerState _state = MqttServerState::UNINITIALIZED;
-    unsigned long _state_change_time = 0;
-    unsigned long _last_connection_attempt_time = 0;
+    // Also written by AsyncMqttClient callbacks from async_tcp task
+    std::atomic<MqttServerState> _state {MqttServerState::UNINITIALIZED};
+    std::atomic<unsigned long> _state_change_time {0};
+    std::atomic<unsigned long> _last_connection_attempt_time {0};
+
+    IntervalHandle _connection_interval;
+    // Stalled loop() doesn't get the queue filled with the same check
+    std::atomic<bool> _check_pending {false};
 
     void _on_connect(bool session_present);
     void _on_disconnect(AsyncMqttClientDisconnectReason reason);
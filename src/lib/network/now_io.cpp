@@ -1,5 +1,6 @@
 #include "now_io.h"
 
+#include <lib/async/pipeline.h>
 #include <lib/async/system_timer.h>
 
 NowIo NowIo::_instance {};
@@ -7,11 +8,14 @@ NowIo NowIo::_instance {};
 bool NowIo::begin() {
     if (!_interaction.begin()) return false;
 
-    _interaction.set_on_message_cb([this](auto message) { _on_message_received(message); });
+    _packet_stream.open();
+    _receive_messages();
+
     return true;
 }
 
 void NowIo::end() {
+    _packet_stream.close();
     _interaction.end();
 }
 
@@ -34,10 +38,8 @@ Future<NowPacket> NowIo::request(const uint8_t *mac_addr, uint8_t type, uint8_t
     uint8_t packet[sizeof(NowPacketHeader) + size];
     _fill_packet_data(packet, type, count, data, size);
 
-    auto request_future = _interaction.request(mac_addr, packet, sizeof(packet));
-    return request_future.then<NowPacket>([this](auto f) {
-        return _process_message(f.result());
-    });
+    return _interaction.request(mac_addr, packet, sizeof(packet))
+           | pipeline::then([this](const EspNowMessage &message) { return _process_message(message); });
 }
 
 Future<void> NowIo::respond(uint8_t id, const uint8_t *mac_addr, uint8_t type) {
@@ -54,7 +56,7 @@ Future<void> NowIo::respond(uint8_t id, const uint8_t *mac_addr, uint8_t type, u
 Future<void> NowIo::ping(const uint8_t *mac_addr) {
     return request(mac_addr, (uint8_t) SpecialPacketTypes::PING)
             .then<void>([](auto f) {
-                auto response = f.result();
+                const auto &response = f.result_ref();
                 auto valid = response.type == (uint8_t) SpecialPacketTypes::SYSTEM_RESPONSE
                         && response.count == 0
                         && response.size == 0;
@@ -67,7 +69,7 @@ Future<void> NowIo::ping(const uint8_t *mac_addr) {
 Future<void> NowIo::discovery(uint8_t *out_mac_addr) {
     return request(AsyncEspNowInteraction::BROADCAST_MAC, (uint8_t) SpecialPacketTypes::DISCOVERY)
             .then<void>([out_mac_addr](auto f) {
-                auto response = f.result();
+                const auto &response = f.result_ref();
                 auto valid = response.type == (uint8_t) SpecialPacketTypes::SYSTEM_RESPONSE
                         && response.count == 0
                         && response.size == 0;
@@ -79,35 +81,43 @@ Future<void> NowIo::discovery(uint8_t *out_mac_addr) {
             });
 }
 
-Future<uint8_t> NowIo::discover_hub(uint8_t *out_mac_addr) {
+Future<uint8_t> NowIo::discover_hub(uint8_t *out_mac_addr, RetryObserver observer) {
     D_PRINT("NowIo: Discovering hub...");
 
-    auto channel = std::make_shared<uint8_t>(0);
-    auto discovery_future = PromiseBase::sequential<uint8_t>(
-        _discover_hub_channel((*channel)++, out_mac_addr),
-        [channel](auto future) { return !future.success() && *channel < 14; },
-        [this, out_mac_addr, channel](auto) {
-            return _discover_hub_channel((*channel)++, out_mac_addr);
-        }
+    // Attempt index is the channel to scan
+    auto discovery_future = retry<uint8_t>(
+        [this, out_mac_addr](uint8_t channel) { return _discover_hub_channel(channel, out_mac_addr); },
+        RetryPolicy {.attempts = 14},
+        std::move(observer)
     );
 
     // Verify hub addr and channel
     return discovery_future
-           .then<void>([this, mac_addr = out_mac_addr](auto) {
+           | pipeline::then([this, mac_addr = out_mac_addr](uint8_t) {
                D_PRINT("NowIo: Verifying hub...");
                return ping(mac_addr);
-           }).then<uint8_t>([discovery_future](auto) {
+           })
+           | pipeline::then([discovery_future] {
                D_PRINT("NowIo: Hub verified...");
-               return discovery_future;
+               return discovery_future.result();
            });
 }
 
+void NowIo::_receive_messages() {
+    auto message_future = _interaction.messages().next();
+
+    // Loop ends when AsyncEspNowInteraction closes the stream
+    message_future.on_finished([this, message_future](bool success) {
+        if (!success) return;
+
+        _on_message_received(message_future.take());
+        _receive_messages();
+    });
+}
+
 void NowIo::_on_message_received(const EspNowMessage &message) {
-    if (_on_packet_cb) {
-        auto packet = _process_message(message);
-        _on_packet_cb(std::move(packet));
-    } else {
-        D_WRITE("NowIo: received package from: ");
+    if (!_packet_stream.push(_process_message(message))) {
+        D_WRITE("NowIo: dropped package from: ");
         D_PRINT_HEX(message.mac_addr, sizeof(message.mac_addr));
     }
 }
@@ -136,17 +146,16 @@ Future<uint8_t> NowIo::_discover_hub_channel(uint8_t channel, uint8_t *out_mac_a
 
     D_PRINTF("NowIo: Trying to discover hub at channel %i...\r\n", channel + 1);
 
-    auto request_future = discovery(out_mac_addr);
-    auto delay_future = SystemTimer::delay(100);
+    // Whichever finishes first cancels the other, so delay timer doesn't outlive the response
+    return PromiseBase::race(discovery(out_mac_addr), SystemTimer::delay(100))
+           | pipeline::then([=](const auto &winner) {
+               if (winner.index() != 0) return Future<uint8_t>::errored();
 
-    return PromiseBase::any({request_future, delay_future})
-           .then<uint8_t>([=](auto) {
-               if (!request_future.finished() || !request_future.success()) return Future<uint8_t>::errored();
                D_PRINTF("NowIo: Hub respond at channel %i!\r\n", channel + 1);
                return Future<uint8_t>::successful(channel);
-           }).on_error([=](auto future) {
+           })
+           | pipeline::on_error([=] {
                D_PRINTF("NowIo: Hub doesn't respond on channel %i\r\n", channel + 1);
-               return future;
            });
 }
 
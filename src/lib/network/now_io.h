@@ -1,8 +1,14 @@
 #pragma once
 
+#include <lib/async/async_stream.h>
+#include <lib/async/retry.h>
 #include <lib/network/base/async_now_interactions.h>
 #include <lib/misc/vector.h>
 
+#ifndef NOW_IO_PACKET_QUEUE_SIZE
+#define NOW_IO_PACKET_QUEUE_SIZE                            (8u)
+#endif
+
 
 enum class SpecialPacketTypes: uint8_t {
     PING      = 0xf0,
@@ -30,14 +36,14 @@ private:
     std::shared_ptr<uint8_t[]> _message_data;
 };
 
-typedef std::function<void(NowPacket)> NowIoPaketCb;
+typedef AsyncStream<NowPacket, NOW_IO_PACKET_QUEUE_SIZE> NowPacketStream;
 
 class NowIo {
     static NowIo _instance;
 
     AsyncEspNowInteraction &_interaction = AsyncEspNowInteraction::instance();
 
-    NowIoPaketCb _on_packet_cb;
+    NowPacketStream _packet_stream {StreamOverflow::DROP_OLDEST};
 
 public:
     static NowIo &instance() { return _instance; }
@@ -85,13 +91,16 @@ public:
     Future<void> ping(const uint8_t *mac_addr);
     Future<void> discovery(uint8_t *out_mac_addr);
 
-    void set_on_packet_cb(NowIoPaketCb on_packet_cb) { _on_packet_cb = std::move(on_packet_cb); }
+    // Incoming packets, consumed at consumer's pace. Oldest ones are dropped when consumer falls behind
+    NowPacketStream &packets() { return _packet_stream; }
 
-    Future<uint8_t> discover_hub(uint8_t *out_mac_addr);
+    // Scans channels one by one, observer gets outcome and latency of each channel scan
+    Future<uint8_t> discover_hub(uint8_t *out_mac_addr, RetryObserver observer = nullptr);
 
 private:
     NowIo() = default;
 
+    void _receive_messages();
     void _on_message_received(const EspNowMessage &message);
 
     void _fill_packet_data(uint8_t *out_packet, uint8_t type, uint8_t count, const uint8_t *data, uint16_t size);
@@ -2,6 +2,7 @@
 #include "misc/button_manager.h"
 #include "misc/state_machine.h"
 
+#include <lib/async/executor.h>
 #include <lib/misc/led.h>
 #include <lib/misc/vector.h>
 #include <lib/network/now_io.h>
@@ -26,7 +27,7 @@ void setup() {
 void loop() {
     state_machine.execute();
     button_manager.tick();
-    led.tick();
+    LoopExecutor::instance().run();
 
     delay(DELAY_AMOUNT);
 }
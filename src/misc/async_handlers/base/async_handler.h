@@ -14,34 +14,30 @@ public:
 protected:
     AsyncHandlerBase() = default;
 
-    virtual void _start(const std::function<Future<void>()> &future_fn, unsigned long timeout);
+    virtual void _start(const std::function<Future<void>()> &future_fn, unsigned long timeout, unsigned long timeout_slack = 0);
 
 private:
     State _state = State::NOT_STARTED;
     Future<void> _future = Future<void>::errored();
 };
 
-inline void AsyncHandlerBase::_start(const std::function<Future<void>()> &future_fn, unsigned long timeout) {
+inline void AsyncHandlerBase::_start(const std::function<Future<void>()> &future_fn, unsigned long timeout, unsigned long timeout_slack) {
     if (_state == State::PENDING) {
         D_PRINT("AsyncHandlerBase: Handler still running. Skipping...");
         return;
     }
 
-    if (timeout > 0) {
-        bool timer_ok = SystemTimer::set_timeout(timeout, [&] {
-            if (_state == State::PENDING) _state = State::TIMEOUT;
-        });
-
-        if (!timer_ok) {
-            D_PRINT("AsyncHandlerBase: Unable to set discovery timeout");
-            _state = State::ERROR;
-            return;
-        }
-    }
-
     _state = State::PENDING;
-    _future = future_fn();
+
+    // Expiration cancels the pending step of the operation, nested operations inherit the deadline
+    _future = future_fn().cancel_after(timeout, timeout_slack);
     _future.on_finished([&](bool success) {
-        if (_state == State::PENDING) _state = success ? State::SUCCESS : State::ERROR;
+        if (_state != State::PENDING) return;
+
+        if (success) {
+            _state = State::SUCCESS;
+        } else {
+            _state = _future.expired() ? State::TIMEOUT : State::ERROR;
+        }
     });
 }
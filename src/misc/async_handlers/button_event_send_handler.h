@@ -10,6 +10,11 @@
 class ButtonEventSendHandler : public AsyncHandlerBase {
 public:
     void send(const uint8_t *mac_addr, const Vector<ButtonEvent> &events, unsigned long timeout = SEND_TIMEOUT);
+
+    [[nodiscard]] const RetryStats &retry_stats() const { return _retry_stats; }
+
+private:
+    RetryStats _retry_stats;
 };
 
 
@@ -20,27 +25,27 @@ inline void ButtonEventSendHandler::send(const uint8_t *mac_addr, const Vector<B
             D_PRINTF("\t- Button #%i: Type: %i, Count %i\r\n", i, events[i].event_type, events[i].click_count);
         }
 
-        auto send_fn = [=, &events] {
-            return NowIo::instance().send(mac_addr, (uint8_t) PacketType::BUTTON, events)
-                                    .with_timeout(timeout);
-        };
-
-        auto retry_left = std::make_shared<int>(SEND_RETRY_COUNT);
-        return PromiseBase::sequential<void>(send_fn(),
-            [=](auto &f) {
-                if (f.success()) return false;
+        return retry<void>(
+            [=, &events](uint8_t) {
+                return NowIo::instance().send(mac_addr, (uint8_t) PacketType::BUTTON, events)
+                                        .cancel_after(timeout, TIMER_SLACK);
+            },
+            RetryPolicy {
+                .attempts = (uint8_t) (SEND_RETRY_COUNT + 1),
+                .backoff = SEND_RETRY_DELAY,
+                .backoff_factor = SEND_RETRY_BACKOFF_FACTOR,
+                .jitter = SEND_RETRY_JITTER,
+                .slack = TIMER_SLACK,
+            },
+            [this](const RetryAttempt &attempt) {
+                _retry_stats.add(attempt);
+                if (attempt.success) return;
 
-                if ((*retry_left)-- > 0) {
+                if (!attempt.last) {
                     D_PRINT("ButtonEventSendHandler: Data sending failed. Retrying...");
-                    return true;
+                } else {
+                    D_PRINT("ButtonEventSendHandler: Data sending failed. No Retry attempts left");
                 }
-
-                D_PRINT("ButtonEventSendHandler: Data sending failed. No Retry attempts left");
-                return false;
-            },
-            [send_fn = std::move(send_fn)](auto) {
-                return SystemTimer::delay(SEND_RETRY_DELAY)
-                        .then<void>([=](auto) { return send_fn(); });
             });
     }, 0);
 }
@@ -12,18 +12,23 @@ public:
     [[nodiscard]] const uint8_t *hub_mac_addr() const;
     [[nodiscard]] uint8_t hub_channel() const;
 
+    // Every attempt is a single channel scan
+    [[nodiscard]] const RetryStats &retry_stats() const { return _retry_stats; }
+
 private:
     uint8_t _hub_mac[6] {};
     uint8_t _channel = 0;
+
+    RetryStats _retry_stats;
 };
 
 
 inline void DiscoveryHandler::discover(unsigned long timeout) {
     _start([=] {
         return NowIo::instance()
-               .discover_hub(_hub_mac)
+               .discover_hub(_hub_mac, [this](const RetryAttempt &attempt) { _retry_stats.add(attempt); })
                .then<void>([=](auto &f) { _channel = f.result(); });
-    }, timeout);
+    }, timeout, TIMER_SLACK);
 }
 
 inline const uint8_t *DiscoveryHandler::hub_mac_addr() const { return state() == State::SUCCESS ? _hub_mac : nullptr; }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "base/async_handler.h"
+#include "constants.h"
 
 class StateIndicationHandler : public AsyncHandlerBase {
 public:
@@ -13,6 +14,6 @@ inline void StateIndicationHandler::blink(Led &led, uint8_t blink_count) {
         led.blink(blink_count, false);
 
         auto wait_interval = (led.blink_active_duration() + led.blink_wait_duration()) * blink_count;
-        return SystemTimer::delay(wait_interval);
+        return SystemTimer::delay(wait_interval, TIMER_SLACK);
     }, 0);
 }
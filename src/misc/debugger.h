@@ -2,6 +2,19 @@
 
 #include <Arduino.h>
 
+#include <lib/async/promise_tracker.h>
+#include <lib/async/system_timer.h>
+
+// Period of promise reports, when instrumentation is enabled
+#ifndef DEBUGGER_PROMISE_REPORT_INTERVAL
+#define DEBUGGER_PROMISE_REPORT_INTERVAL                    (10000ul)
+#endif
+
+// Pending promises older than this are reported as possibly leaked
+#ifndef DEBUGGER_PROMISE_LEAK_AGE
+#define DEBUGGER_PROMISE_LEAK_AGE                           (5000ul)
+#endif
+
 class Debugger {
 public:
     static void begin() {
@@ -15,5 +28,12 @@ public:
         while (!Serial && millis() - start_t < 15000ul) delay(100);
 
         delay(2000);
+
+#if PROMISE_INSTRUMENTATION
+        SystemTimer::set_interval(DEBUGGER_PROMISE_REPORT_INTERVAL, [] {
+            PromiseTracker::dump_stats();
+            PromiseTracker::dump_unresolved(DEBUGGER_PROMISE_LEAK_AGE);
+        });
+#endif
     }
 };